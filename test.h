@@ -1,5 +1,5 @@
 /** test.h, an extremly simple test framework.
- * Version 1.7
+ * Version 1.37
  * Copyright (C) 2022-2024 Tobias Kreilos, Offenburg University of Applied
  * Sciences
  */
@@ -13,18 +13,40 @@
  * the program.
  * There is a TEST macro, which you can place outside main to group
  * tests together. Code in the macro is automatically executed at the beginning
- * of the program.
+ * of the program. If TEST_H_AUTORUN is defined to 0, the tests are only
+ * registered and Test::runAll() executes them.
  * The file also defines a class InstanceCount, that can be used to
  * count how many instances of an object are still alive at the end of a
  * program. To use it, derive your class from InstanceCount<ClassName> and the
  * message is automatically printed at the end of the program.
  *
- * The functions are thread- and reentrant-safe. Support for OpenMP is included.
- * Execution with MPI is supported, but no collection of the results occurs. All
- * tests are executed locally, results are printed for every node separately.
+ * The functions are thread- and reentrant-safe. Support for OpenMP is included,
+ * checks from different threads do not synchronize with each other.
+ * Execution with MPI is supported. By default all tests are executed locally
+ * and results are printed for every rank separately. If TEST_H_MPI is defined
+ * and mpi.h is included before this file, the results are collected when
+ * MPI_Finalize() is called: rank 0 prints its own checks, the failing checks
+ * of all other ranks and one summary with the counts of all ranks.
  *
- * Caution: the TEST macro uses static storage of objects, so be aware of the
- * static initialization order fiasco when using multiple source files.
+ * By default every check prints a line. To print only failing checks, define
+ * TEST_H_QUIET before including this file or call
+ * Test::setVerbosity(Test::Verbosity::Quiet) at runtime. Passing checks are
+ * then only counted and never formatted.
+ *
+ * Output is buffered per thread and written in chunks of TEST_H_BUFFER_SIZE
+ * bytes to std::cout, or to any other Test::Sink installed with
+ * Test::setSink(). Failing checks flush the output immediately unless
+ * Test::setFlushOnFailure(false) is called.
+ *
+ * In larger projects, define TEST_H_SPLIT for all source files and
+ * TEST_H_IMPLEMENTATION in one of them. The framework itself is then compiled
+ * only once and the other files include little more than the declarations.
+ *
+ * Caution: with TEST_H_AUTORUN, tests run during static initialization, so be
+ * aware of the static initialization order fiasco when using multiple source
+ * files. With TEST_H_AUTORUN set to 0, the tests are registered without
+ * dynamic allocation in constant-initialized nodes and only run by
+ * Test::runAll(), when all global objects are constructed.
  *
  * Example usage:
  *
@@ -42,253 +64,6599 @@
 #ifndef VERY_SIMPLE_TEST_H
 #define VERY_SIMPLE_TEST_H
 
+/**
+ * Split mode: define TEST_H_SPLIT (e.g. with -DTEST_H_SPLIT) for all source
+ * files and TEST_H_IMPLEMENTATION before the include in exactly one of them.
+ * The reporting, formatting and summary code is then only compiled in that
+ * file, the others only get the declarations and the templates of the checks,
+ * without iostreams. TEST_H_IMPLEMENTATION alone implies TEST_H_SPLIT.
+ * Without either, everything is inline in every file.
+ */
+#if defined(TEST_H_IMPLEMENTATION) && !defined(TEST_H_SPLIT)
+#define TEST_H_SPLIT
+#endif
+
+#if !defined(TEST_H_SPLIT) || defined(TEST_H_IMPLEMENTATION)
+#define TEST_H_WITH_IMPLEMENTATION
+#endif
+
+/**
+ * Functions of the implementation, inline unless they are compiled once in
+ * split mode
+ */
+#ifdef TEST_H_SPLIT
+#define TEST_H_API
+#else
+#define TEST_H_API inline
+#endif
+
 #include <atomic>
+#include <algorithm>
+#include <charconv>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iosfwd>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#if __has_include(<version>)
+#include <version>
+#endif
+#ifdef __cpp_lib_source_location
+#include <source_location>
+#endif
+// std::format is as expensive to include as iostreams, split mode prints
+// values with operator<< only
+#if defined(__cpp_lib_format) && !defined(TEST_H_SPLIT)
+#include <format>
+#define TEST_H_WITH_FORMAT
+#endif
+
+// _ReadWriteBarrier() of doNotOptimize() and clobberMemory() with MSVC
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#if defined(TEST_H_MPI) && defined(MPI_VERSION)
+#define TEST_H_WITH_MPI
+#endif
+
+#ifdef TEST_H_WITH_IMPLEMENTATION
+#include <chrono>
+#include <deque>
+#include <exception>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <thread>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define TEST_H_POSIX
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__)
+#include <pthread.h>
+#include <sched.h>
+#define TEST_H_AFFINITY
+#endif
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define TEST_H_PERF_EVENTS
+#endif
+#endif  // TEST_H_WITH_IMPLEMENTATION
+
+/**
+ * Counters of different threads are kept this many bytes apart
+ */
+#ifndef TEST_H_CACHE_LINE
+#define TEST_H_CACHE_LINE 64
+#endif
+
+/**
+ * Number of differing elements printed by a failing check_range()
+ */
+#ifndef TEST_H_MAX_MISMATCHES
+#define TEST_H_MAX_MISMATCHES 10
+#endif
+
+/**
+ * Strings longer than this are shortened to an excerpt in the output
+ */
+#ifndef TEST_H_MAX_STRING_LENGTH
+#define TEST_H_MAX_STRING_LENGTH 256
+#endif
+
+/**
+ * Size in bytes at which the output buffer of a thread is handed to the sink
+ */
+#ifndef TEST_H_BUFFER_SIZE
+#define TEST_H_BUFFER_SIZE 65536
+#endif
+
+/**
+ * If set to 1, InstanceCounter counts in per-thread slots instead of shared
+ * atomic counters
+ */
+#ifndef TEST_H_PER_THREAD_COUNTERS
+#define TEST_H_PER_THREAD_COUNTERS 0
+#endif
+
+/**
+ * If set to 1 (the default), tests are executed while they are registered,
+ * i.e. before main. With 0, tests are only registered and executed by
+ * Test::runAll().
+ */
+#ifndef TEST_H_AUTORUN
+#define TEST_H_AUTORUN 1
+#endif
+
+/**
+ * Guarantees the constant initialization of the nodes of registered tests,
+ * if the compiler supports it
+ */
+#ifdef __cpp_constinit
+#define TEST_H_CONSTINIT constinit
+#else
+#define TEST_H_CONSTINIT
+#endif
+
 /** Simple macro to execute the code that follows the macro (without call from
  * main)
  *
- * Define a class, that is directly instantiated
- * and contains the test code in the constructor.
+ * Define a function containing the test code and a constant-initialized node
+ * with its name and location. Depending on TEST_H_AUTORUN the function is
+ * executed directly during registration or the node is linked into the list
+ * of tests executed later by Test::runAll().
  *
  * Usage:
  * TEST(MyTest) {
  *    // test code
  * }
  */
-#define TEST(name)              \
-  struct _TestClass##name {     \
-    _TestClass##name();         \
-  } _TestClass##name##Instance; \
-  _TestClass##name::_TestClass##name()
+#define TEST(name)                                                         \
+  static void _TestFunction##name();                                       \
+  static TEST_H_CONSTINIT ::Test::Detail::TestNode _TestNode##name{        \
+      {&_TestFunction##name, #name, __FILE__, __LINE__, false}, nullptr};  \
+  static const ::Test::Detail::Registrar _TestRegistrar##name(             \
+      _TestNode##name, TEST_H_AUTORUN);                                    \
+  static void _TestFunction##name()
 
-// Use a namespace to hide implementation details
-namespace Test::Detail {
+/**
+ * Register a micro benchmark, which is executed like a TEST, but after all
+ * tests and never in parallel to other tests. The code has access to a
+ * Test::Benchmark named benchmark and passes the function to measure to
+ * benchmark.run().
+ *
+ * Usage:
+ * BENCHMARK(Sum) {
+ *   std::vector<int> v(1000, 1);
+ *   benchmark.setItemsPerIteration(v.size());
+ *   benchmark.run([&] {
+ *     Test::doNotOptimize(std::accumulate(v.begin(), v.end(), 0));
+ *   });
+ * }
+ */
+#define BENCHMARK(name)                                                   \
+  static void _BenchmarkFunction##name(::Test::Benchmark& benchmark);     \
+  static void _BenchmarkRunner##name() {                                  \
+    ::Test::Benchmark benchmark(#name);                                   \
+    _BenchmarkFunction##name(benchmark);                                  \
+  }                                                                       \
+  static TEST_H_CONSTINIT ::Test::Detail::TestNode _BenchmarkNode##name{  \
+      {&_BenchmarkRunner##name, #name, __FILE__, __LINE__, true}, nullptr}; \
+  static const ::Test::Detail::Registrar _BenchmarkRegistrar##name(       \
+      _BenchmarkNode##name, TEST_H_AUTORUN);                              \
+  static void _BenchmarkFunction##name(::Test::Benchmark& benchmark)
 
 /**
- * Make it possible to print the underlying value of class enums with ostream
+ * Register a property, a TEST whose code is executed for many random
+ * arguments. The parameters are declared in the macro, their values are
+ * created by Test::Generator, which supports arithmetic types and std::string
+ * and can be specialized for other types. Failing arguments are shrunk and
+ * only the smallest failing case is reported.
  *
- * The expression typename std::enable_if<std::is_enum<T>::value,
- * std::ostream>::type decays to ostream if the type T is an enum. Otherwise,
- * the function is not generated.
+ * Usage:
+ * PROPERTY(ReverseTwice, std::string s) {
+ *   check(reverse(reverse(s)), s);
+ * }
  */
-template <typename T>
-std::ostream& operator<<(
-    typename std::enable_if<std::is_enum<T>::value, std::ostream>::type& stream,
-    const T& e) {
-  return stream << static_cast<typename std::underlying_type<T>::type>(e);
-}
+#define PROPERTY(name, ...)                                     \
+  static void _PropertyFunction##name(__VA_ARGS__);             \
+  TEST(name) {                                                  \
+    ::Test::Detail::checkProperty(                              \
+        &_PropertyFunction##name, #__VA_ARGS__,                 \
+        ::Test::SourceLocation(__FILE__, __LINE__));            \
+  }                                                             \
+  static void _PropertyFunction##name(__VA_ARGS__)
 
 /**
- * Convert anything to a string.
+ * Register a TEST whose code runs iterations times on each of threads threads
+ * (0 means one per core). The threads are pinned to the cores where the
+ * system allows it and start together behind a barrier. The code has access
+ * to a const Test::Stress& named stress. Afterwards the time, the number of
+ * iterations per second and the checks of every thread are printed.
+ *
+ * STRESS_TEST(CounterIncrement, 4, 100000) {
+ *   counter.increment();
+ *   check(counter.get() > 0);
+ * }
  */
-template <typename T>
-std::string toString(const T& t) {
-  std::ostringstream ss;
-  ss << std::setprecision(10);
-  ss << t;
-  return "\"" + ss.str() + "\"";
-}
+#define STRESS_TEST(name, threads, iterations)                           \
+  static void _StressFunction##name(const ::Test::Stress& stress);       \
+  TEST(name) {                                                           \
+    ::Test::Detail::runStress(&_StressFunction##name, threads, iterations, \
+                              #name);                                    \
+  }                                                                      \
+  static void _StressFunction##name(                                     \
+      [[maybe_unused]] const ::Test::Stress& stress)
 
 /**
- * Convert bools to string "true" or "false" instead of 0 and 1
+ * Location of the caller, used as default argument of the checks
  */
-template <>
-inline std::string toString<bool>(const bool& b) {
-  return b ? "\"true\"" : "\"false\"";
-}
+#if defined(__cpp_lib_source_location)
+#define TEST_H_CURRENT_LOCATION \
+  ::Test::SourceLocation(std::source_location::current())
+#elif defined(__GNUC__) || defined(__clang__) || \
+    (defined(_MSC_VER) && _MSC_VER >= 1926)
+#define TEST_H_CURRENT_LOCATION \
+  ::Test::SourceLocation(__builtin_FILE(), __builtin_LINE())
+#else
+#define TEST_H_CURRENT_LOCATION ::Test::SourceLocation()
+#endif
 
 /**
- * Comparison function for different types
+ * check() with the location given explicitly, for compilers that cannot
+ * determine the location of the caller
  */
-template <typename T>
-bool isEqual(const T& t1, const T& t2) {
-  return t1 == t2;
-}
+#ifndef CHECK
+#define CHECK(...) \
+  ::check(__VA_ARGS__, ::Test::SourceLocation(__FILE__, __LINE__))
+#endif
+
+#define TEST_H_CONCAT_IMPL(a, b) a##b
+#define TEST_H_CONCAT(a, b) TEST_H_CONCAT_IMPL(a, b)
 
 /**
- * Double values are equal if they differ no more than 1e-8
+ * Fail if the rest of the enclosing scope allocates memory with operator new.
+ * Requires TEST_H_TRACK_ALLOCATIONS in one source file.
  */
-template <>
-inline bool isEqual<double>(const double& expectedValue,
-                            const double& actualValue) {
-  const double epsilon = 1e-4;
-  const double distance = fabs(actualValue - expectedValue);
-  return (distance < epsilon);
-}
+#define NO_ALLOC_SCOPE \
+  const ::Test::AllocationScope TEST_H_CONCAT(_TestAllocationScope, __LINE__)(0)
+
+namespace Test {
 
 /**
- * Float values are equal if they differ no more than 1e-4
+ * Amount of output produced by the checks.
+ * Quiet: only failing checks are printed
+ * Normal: every check is printed
  */
-template <>
-inline bool isEqual<float>(const float& expectedValue,
-                           const float& actualValue) {
-  const double epsilon = 1e-4;
-  const double distance = fabs(actualValue - expectedValue);
-  return (distance < epsilon);
-}
+enum class Verbosity { Quiet, Normal };
 
 /**
- * This class realizes some basics of the test framework.
- * Test summary is printed in the destructor.
- * Apart from that, the class implements counting of total and failed tests,
- * comparison of floating point numbers within sensible boundaries and prints
- * the result of each test on the command line.
+ * Allowed difference between floating point values in checks. Two values
+ * are equal if they differ less than absoluteEpsilon, or at most
+ * relativeEpsilon times the larger of the two magnitudes, or if there are at
+ * most maxUlps representable values between them. Combine tolerances with |.
+ *
+ * Usage:
+ * check(x, 1.0, Test::Tolerance::relative(1e-12) | Test::Tolerance::ulps(4));
  */
-class Test {
- public:
-  /**
-   * Test class is a Singleton
-   */
-  static Test& instance() {
-    static Test test;
-    return test;
+struct Tolerance {
+  double absoluteEpsilon = 1e-4;
+  double relativeEpsilon = 0;
+  std::uint64_t maxUlps = 0;
+
+  static constexpr Tolerance absolute(double epsilon) {
+    return {epsilon, 0, 0};
   }
 
-  /**
-   * the main entry point for tests. Test two values for equality and output the
-   * result.
-   */
-  template <typename T>
-  bool check(const T& expectedValue, const T& actualValue) {
-    bool testResult = isEqual(expectedValue, actualValue);
-    if (testResult == true) {
-      registerPassingTest();
-#ifdef _OPENMP
-#pragma omp critical
-#endif
-      std::cout << "Test successful! Expected value == actual value (="
-                << toString(expectedValue) << ")" << std::endl;
-    } else {
-      registerFailingTest();
-#ifdef _OPENMP
-#pragma omp critical
+  static constexpr Tolerance relative(double epsilon) {
+    return {0, epsilon, 0};
+  }
+
+  static constexpr Tolerance ulps(std::uint64_t ulps) { return {0, 0, ulps}; }
+
+  constexpr Tolerance operator|(const Tolerance& other) const {
+    return {std::max(absoluteEpsilon, other.absoluteEpsilon),
+            std::max(relativeEpsilon, other.relativeEpsilon),
+            std::max(maxUlps, other.maxUlps)};
+  }
+};
+
+/**
+ * Passed to the code of a STRESS_TEST: the thread that runs it, numbered from
+ * 0 to threads - 1, and how often it has run on this thread before
+ */
+struct Stress {
+  std::size_t thread;
+  std::size_t threads;
+  std::uint64_t iteration;
+};
+
+/**
+ * A test registered with the TEST macro
+ */
+struct TestCase {
+  void (*function)();
+  const char* name;
+  const char* file;
+  int line;
+  bool benchmark;
+};
+
+/**
+ * Position of a check in the source code. Only a pointer to the static file
+ * name is kept, file is nullptr if the location is unknown.
+ */
+struct SourceLocation {
+  const char* file = nullptr;
+  unsigned line = 0;
+
+  constexpr SourceLocation() = default;
+  constexpr SourceLocation(const char* file, unsigned line)
+      : file(file), line(line) {}
+#ifdef __cpp_lib_source_location
+  constexpr SourceLocation(const std::source_location& location)
+      : file(location.file_name()), line(location.line()) {}
 #endif
-      std::cout << "Error in test: expected value " << toString(expectedValue)
-                << ", but actual value was " << toString(actualValue)
-                << std::endl;
-    }
+};
 
-    return testResult;
+/**
+ * Thrown by a failing require() to abort the running TEST, caught by the
+ * runner. Not derived from std::exception, so handlers in the code under test
+ * do not catch it by accident.
+ */
+struct RequireFailure {};
+
+/**
+ * Number of executed and failed checks
+ */
+struct Summary {
+  std::uint64_t executed = 0;
+  std::uint64_t failed = 0;
+};
+
+/**
+ * Calls of operator new and delete by a thread, counted if
+ * TEST_H_TRACK_ALLOCATIONS is defined in one source file
+ */
+struct Allocations {
+  std::uint64_t allocations = 0;
+  std::uint64_t deallocations = 0;
+  std::uint64_t bytes = 0;  // requested by all allocations
+};
+
+/**
+ * Destination of all output of the framework. Derive from this class to
+ * redirect the output, e.g. into a file, and install it with Test::setSink().
+ * The framework hands over output in large chunks.
+ */
+class Sink {
+ public:
+  virtual ~Sink() = default;
+  virtual void write(const char* data, std::size_t size) = 0;
+  virtual void flush() {}
+};
+
+/**
+ * Sink writing to an output stream, std::cout by default
+ */
+class StreamSink : public Sink {
+ public:
+  StreamSink();
+  explicit StreamSink(std::ostream& stream) : stream_(stream) {}
+
+  void write(const char* data, std::size_t size) override;
+  void flush() override;
+
+ private:
+  std::ostream& stream_;
+};
+
+/**
+ * Sink writing to a file, which is created or truncated by the constructor
+ */
+class FileSink : public Sink {
+ public:
+  explicit FileSink(const char* path) : file_(std::fopen(path, "wb")) {}
+
+  FileSink(const FileSink&) = delete;
+  FileSink& operator=(const FileSink&) = delete;
+
+  ~FileSink() override {
+    if (file_ != nullptr)
+      std::fclose(file_);
+  }
+
+  bool isOpen() const { return file_ != nullptr; }
+
+  void write(const char* data, std::size_t size) override {
+    if (file_ != nullptr)
+      std::fwrite(data, 1, size, file_);
+  }
+
+  void flush() override {
+    if (file_ != nullptr)
+      std::fflush(file_);
   }
 
  private:
+  std::FILE* file_;
+};
+
+/**
+ * A reported check. expected and actual are the plain text of the operands,
+ * without quotes and escapes. Checks that describe their result with a
+ * message, e.g. check_range(), only set message.
+ */
+struct CheckEvent {
+  bool passed;
+  const TestCase* test;  // nullptr outside of a TEST
+  std::string_view expected;
+  std::string_view actual;
+  std::string_view message;
+  SourceLocation location;
+};
+
+/**
+ * Hardware events counted by Test::PerfCounters, all 0 and available false
+ * where the counters cannot be used
+ */
+struct PerfCounts {
+  std::uint64_t cycles = 0;
+  std::uint64_t instructions = 0;
+  std::uint64_t cacheMisses = 0;
+  std::uint64_t branchMisses = 0;
+  bool available = false;
+};
+
+/**
+ * A finished TEST or BENCHMARK. counters is only set if the hardware events
+ * of the test were counted, see Test::setPerfCounters().
+ */
+struct TestEvent {
+  const TestCase* test;
+  std::uint64_t checks;
+  std::uint64_t failures;
+  double seconds;
+  const PerfCounts* counters = nullptr;
+};
+
+/**
+ * Formats the results instead of the human readable text, e.g. as JUnit XML
+ * (Test::JUnitReporter), TAP (Test::TapReporter) or JSON Lines
+ * (Test::JsonLinesReporter). Install it with Test::setReporter() before the
+ * first check.
+ *
+ * A reporter appends to the output of the calling thread, which goes through
+ * the same buffers as the text reports and ends up in the sink, so nothing is
+ * kept in memory for long. Apart from begin() and end(), the functions are
+ * called concurrently by all threads that run checks. The events of a test
+ * come from the thread that runs it, in the order testStarted(), checked(),
+ * testFinished(). Passing checks are not reported in quiet mode.
+ */
+class Reporter {
+ public:
+  virtual ~Reporter() = default;
+
   /**
-   * Print a summary of all tests at the end of program execution.
-   *
-   * Since the Test class is a static Singleton, destruction happens when the
-   * program terminates, so this is a good place to print the summary.
+   * Start of the output, called before the first event
    */
-  ~Test() {
-    std::cout << "\n--------------------------------------" << std::endl;
-    std::cout << "Test summary:" << std::endl;
-    std::cout << "Executed tests: " << numTests_ << std::endl;
-    std::cout << "Failed tests: " << numFailedTests_ << std::endl;
-  }
+  virtual void begin(std::string& /*out*/) {}
+
+  virtual void testStarted(std::string& /*out*/, const TestCase& /*test*/) {}
 
-  void registerPassingTest() { numTests_++; }
+  virtual void checked(std::string& out, const CheckEvent& check) = 0;
 
-  void registerFailingTest() {
-    numTests_++;
-    numFailedTests_++;
+  virtual void testFinished(std::string& /*out*/, const TestEvent& /*test*/) {
   }
 
   /**
-   * For statistics
+   * Called in the runner with the output of a test that ran in a worker
+   * process, see Test::setProcesses(). The events of the test have already
+   * been formatted by the reporter in the worker.
    */
-  std::atomic<int> numTests_ = 0;
+  virtual void forwarded(std::string_view /*output*/) {}
 
   /**
-   * For statistics
+   * Free text, e.g. the results of benchmarks and instance counters
    */
-  std::atomic<int> numFailedTests_ = 0;
-};
+  virtual void message(std::string& out, std::string_view text) { out += text; }
 
-template <typename T>
-class InstanceCounterHelper {
- public:
-  ~InstanceCounterHelper() {
-    std::cout << "The remaining number of objects of type " << typeid(T).name()
-              << " at the end of the program is " << count;
-    if (count > 0)
-      std::cout << " (NOT zero!)";
-    std::cout << "\nThe total number of objects created was " << total
-              << std::endl;
-  }
+  /**
+   * End of the output at the end of the program, with the summary of all
+   * checks
+   */
+  virtual void end(std::string& /*out*/, const Summary& /*summary*/) {}
+};
 
-  void increment() {
-    count++;
-    total++;
-  }
+}  // namespace Test
 
-  void decrement() { count--; }
+// Use a namespace to hide implementation details
+namespace Test::Detail {
 
- private:
-  std::atomic<int> count = 0;
-  std::atomic<int> total = 0;
-};
+/**
+ * Detect whether a value of type T can be written to an ostream
+ */
+template <typename T, typename = void>
+struct IsStreamable : std::false_type {};
 
-}  // namespace Test::Detail
+template <typename T>
+struct IsStreamable<T, std::void_t<decltype(std::declval<std::ostream&>()
+                                            << std::declval<const T&>())>>
+    : std::true_type {};
 
+#ifdef TEST_H_WITH_FORMAT
 /**
- * Count the instances of a class T.
- * Result gets printed automatically at the end of the program.
- * To use it, inherit T from InstanceCounter<T>, e.g.
- * class MyClass : InstanceCounter<MyClass>
+ * Detect whether std::format can print a value of type T, disabled
+ * specializations of std::formatter are not default constructible
  */
 template <typename T>
-class InstanceCounter {
- public:
-  InstanceCounter() { counter().increment(); }
+constexpr bool isFormattable =
+    std::is_default_constructible_v<std::formatter<T, char>>;
+#endif
 
-  InstanceCounter(const InstanceCounter&) { counter().increment(); }
+/**
+ * Append a number to a string, printed with 10 significant digits for floating
+ * point values. Uses std::to_chars directly on the end of the string.
+ */
+template <typename T>
+void appendNumber(std::string& out, T number) {
+  const std::size_t size = out.size();
+  out.resize(size + 64);
+  char* first = out.data() + size;
+  char* last = out.data() + out.size();
+  if constexpr (std::is_integral_v<T>) {
+    if constexpr (std::is_signed_v<T>)
+      last = std::to_chars(first, last, static_cast<long long>(number)).ptr;
+    else
+      last = std::to_chars(first, last, static_cast<unsigned long long>(number))
+                 .ptr;
+  } else {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    last = std::to_chars(first, last, number, std::chars_format::general, 10)
+               .ptr;
+#else
+    last = first + std::snprintf(first, last - first, "%.10Lg",
+                                 static_cast<long double>(number));
+#endif
+  }
+  out.resize(last - out.data());
+}
 
-  InstanceCounter(const InstanceCounter&&) { counter().increment(); }
+/**
+ * Write the object to a stream with operator<<, for appendStreamed()
+ */
+template <typename T>
+void streamErased(std::ostream& stream, const void* object) {
+  stream << *static_cast<const T*>(object);
+}
 
-  virtual ~InstanceCounter() { counter().decrement(); }
+/**
+ * Append the output of write with 10 significant digits for floating point
+ * values. The stream only exists in the implementation, so the templates of
+ * the checks do not need iostreams.
+ */
+TEST_H_API void appendStreamed(std::string& out,
+                               void (*write)(std::ostream&, const void*),
+                               const void* object);
 
-  Test::Detail::InstanceCounterHelper<T>& counter() {
-    static Test::Detail::InstanceCounterHelper<T> c;
-    return c;
+/**
+ * Append the textual representation of anything to a string.
+ * Numbers, characters, bools and strings are converted without iostreams,
+ * other types with std::format if available or with operator<<.
+ */
+template <typename T>
+void appendValue(std::string& out, const T& value) {
+  if constexpr (std::is_same_v<T, bool>) {
+    out += value ? "true" : "false";
+  } else if constexpr (std::is_same_v<T, char> ||
+                       std::is_same_v<T, signed char> ||
+                       std::is_same_v<T, unsigned char>) {
+    out += static_cast<char>(value);
+  } else if constexpr (std::is_arithmetic_v<T>) {
+    appendNumber(out, value);
+  } else if constexpr (std::is_enum_v<T> && !IsStreamable<T>::value) {
+    // print the underlying value of class enums
+    appendNumber(out, static_cast<std::underlying_type_t<T>>(value));
+  } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+    if constexpr (std::is_pointer_v<T>) {
+      if (value == nullptr) {
+        out += "nullptr";
+        return;
+      }
+    }
+    out += std::string_view(value);
+#ifdef TEST_H_WITH_FORMAT
+  } else if constexpr (isFormattable<T> && !IsStreamable<T>::value) {
+    std::format_to(std::back_inserter(out), "{}", value);
+#endif
+  } else {
+    appendStreamed(out, &streamErased<T>, &value);
   }
-};
+}
 
 /**
- * Check if the expected value is equal to the actual value.
- * Result is printed on the command line and at the end of the program, a
- * summary of all tests is printed.
+ * Append a string with quotes, backslashes and control characters escaped.
+ * Unescaped characters are copied in runs.
  */
-template <typename T1, typename T2>
-void check(const T1& actualValue, const T2& expectedValue) {
-  const T1& expectedValueCasted{
-      expectedValue};  // allows conversion in general, but avoids narrowing
-                       // conversion
-  Test::Detail::Test::instance().check(expectedValueCasted, actualValue);
+inline void appendEscaped(std::string& out, std::string_view text) {
+  static constexpr char hexDigits[] = "0123456789abcdef";
+  std::size_t runBegin = 0;
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(text[i]);
+    if (c >= 0x20 && c != 0x7f && c != '"' && c != '\\')
+      continue;
+    out.append(text.data() + runBegin, i - runBegin);
+    runBegin = i + 1;
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      default:
+        out += "\\x";
+        out += hexDigits[c >> 4];
+        out += hexDigits[c & 0xf];
+    }
+  }
+  out.append(text.data() + runBegin, text.size() - runBegin);
 }
 
-// allow conversion from int to double explicitely
-template <>
-inline void check(const double& actualValue, const int& expectedValue) {
-  Test::Detail::Test::instance().check(static_cast<double>(expectedValue),
-                                       actualValue);
+/**
+ * Begin and end of the part of a string that is printed: all of it, or
+ * TEST_H_MAX_STRING_LENGTH characters from shortly before position
+ */
+inline std::pair<std::size_t, std::size_t> excerpt(std::string_view text,
+                                                   std::size_t position) {
+  constexpr std::size_t maxLength = TEST_H_MAX_STRING_LENGTH;
+  std::size_t begin = 0;
+  if (text.size() > maxLength)
+    begin = std::min(position - std::min(position, maxLength / 4),
+                     text.size() - maxLength);
+  return {begin, std::min(text.size(), begin + maxLength)};
 }
 
 /**
- * Check if the entered value is true.
- * Result is printed on the command line and at the end of the program, a
- * summary of all tests is printed.
+ * Append a string enclosed in quotes and escaped. A string longer than
+ * TEST_H_MAX_STRING_LENGTH is cut to an excerpt that starts shortly before
+ * position, omitted parts are marked with "..." and the full length is
+ * added.
  */
-inline void check(bool a) {
-  Test::Detail::Test::instance().check(true, a);
+inline void appendString(std::string& out, std::string_view text,
+                         std::size_t position = 0) {
+  const auto [begin, end] = excerpt(text, position);
+  if (begin > 0)
+    out += "...";
+  out += '"';
+  appendEscaped(out, text.substr(begin, end - begin));
+  out += '"';
+  if (end < text.size())
+    out += "...";
+  if (end - begin < text.size()) {
+    out += " (";
+    appendNumber(out, text.size());
+    out += " characters)";
+  }
 }
 
+/**
+ * The same excerpt as appendString() without quotes and escapes, for the
+ * reporters, which escape the text for their format themselves
+ */
+inline void appendPlainString(std::string& out, std::string_view text,
+                              std::size_t position = 0) {
+  const auto [begin, end] = excerpt(text, position);
+  if (begin > 0)
+    out += "...";
+  out += text.substr(begin, end - begin);
+  if (end < text.size())
+    out += "...";
+  if (end - begin < text.size()) {
+    out += " (";
+    appendNumber(out, text.size());
+    out += " characters)";
+  }
+}
+
+/**
+ * Append a value to a string, enclosed in quotes. Strings are escaped and
+ * shortened by appendString().
+ */
+template <typename T>
+void appendQuoted(std::string& out, const T& value) {
+  if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+    if constexpr (std::is_pointer_v<T>) {
+      if (value == nullptr) {
+        out += "nullptr";
+        return;
+      }
+    }
+    appendString(out, std::string_view(value));
+  } else {
+    out += '"';
+    appendValue(out, value);
+    out += '"';
+  }
+}
+
+/**
+ * Convert anything to a string.
+ */
+template <typename T>
+std::string toString(const T& t) {
+  std::string result;
+  appendQuoted(result, t);
+  return result;
+}
+
+/**
+ * Reference to an operand of a check that is only formatted when the text is
+ * actually needed. Keeps the formatting code out of the templates of check().
+ */
+class Value {
+ public:
+  template <typename T>
+  explicit Value(const T& value)
+      : object_(&value),
+        append_(&appendErased<T>),
+        appendPlain_(&appendPlainErased<T>),
+        copyableSize_(copyableSize<T>()) {}
+
+  /**
+   * Append the operand to a string, enclosed in quotes
+   */
+  void appendTo(std::string& out) const { append_(out, object_); }
+
+  /**
+   * Append the operand to a string without quotes and escapes
+   */
+  void appendPlainTo(std::string& out) const { appendPlain_(out, object_); }
+
+  using AppendFunction = void (*)(std::string&, const void*);
+
+  /**
+   * Numbers and enums are formatted from their bytes alone, so a copy of them
+   * can be formatted later by another thread, with appendFunction(). Size of
+   * such an operand, 0 for all other types.
+   */
+  std::size_t copyableSize() const { return copyableSize_; }
+
+  const void* object() const { return object_; }
+
+  AppendFunction appendFunction() const { return append_; }
+
+ private:
+  template <typename T>
+  static constexpr std::size_t copyableSize() {
+    return (std::is_arithmetic_v<T> || std::is_enum_v<T>) && sizeof(T) <= 16
+               ? sizeof(T)
+               : 0;
+  }
+
+  template <typename T>
+  static void appendErased(std::string& out, const void* object) {
+    appendQuoted(out, *static_cast<const T*>(object));
+  }
+
+  template <typename T>
+  static void appendPlainErased(std::string& out, const void* object) {
+    const T& value = *static_cast<const T*>(object);
+    if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+      if constexpr (std::is_pointer_v<T>) {
+        if (value == nullptr) {
+          appendValue(out, value);
+          return;
+        }
+      }
+      appendPlainString(out, std::string_view(value));
+    } else {
+      appendValue(out, value);
+    }
+  }
+
+  const void* object_;
+  AppendFunction append_;
+  AppendFunction appendPlain_;
+  std::size_t copyableSize_;
+};
+
+/**
+ * Tolerance set with Test::setTolerance()
+ */
+inline Tolerance globalTolerance;
+
+/**
+ * Tolerance of the innermost Test::ToleranceScope of the thread, if any
+ */
+inline thread_local const Tolerance* scopedTolerance = nullptr;
+
+inline const Tolerance& currentTolerance() {
+  return scopedTolerance != nullptr ? *scopedTolerance : globalTolerance;
+}
+
+/**
+ * Allocation counters of the thread, written by the replaced operator new
+ * and delete. They are constant initialized and trivially destructible, so
+ * they are safe to use before main and while threads exit.
+ */
+inline thread_local Allocations threadAllocations;
+
+/**
+ * Set once the replaced operator new is linked into the program
+ */
+inline std::atomic<bool> allocationsTracked = false;
+
+inline void recordAllocation(std::size_t size) {
+  Allocations& allocations = threadAllocations;
+  ++allocations.allocations;
+  allocations.bytes += size;
+  if (!allocationsTracked.load(std::memory_order_relaxed))
+    allocationsTracked.store(true, std::memory_order_relaxed);
+}
+
+inline void recordDeallocation(void* pointer) {
+  if (pointer != nullptr)
+    ++threadAllocations.deallocations;
+}
+
+/**
+ * Number of representable floating point values between a and b
+ */
+template <typename T>
+std::uint64_t ulpDistance(T a, T b) {
+  using Bits =
+      std::conditional_t<sizeof(T) == sizeof(std::uint64_t), std::uint64_t,
+                         std::uint32_t>;
+  static_assert(sizeof(T) == sizeof(Bits), "unsupported floating point type");
+  if (std::isnan(a) || std::isnan(b))
+    return std::numeric_limits<std::uint64_t>::max();
+  // map the bit patterns to unsigned integers with the same order as the values
+  constexpr Bits sign = Bits(1) << (sizeof(Bits) * 8 - 1);
+  auto key = [](T value) {
+    Bits bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & sign) != 0 ? Bits(~bits) : Bits(bits | sign);
+  };
+  const Bits keyA = key(a);
+  const Bits keyB = key(b);
+  return keyA > keyB ? keyA - keyB : keyB - keyA;
+}
+
+/**
+ * Floating point comparison: the values are equal if they are within any of
+ * the bounds of the tolerance. Infinities are only equal to themselves and
+ * NaN to nothing, whatever the tolerance.
+ */
+template <typename T>
+bool isClose(T expectedValue, T actualValue, const Tolerance& tolerance) {
+  if (!std::isfinite(expectedValue) || !std::isfinite(actualValue))
+    return actualValue == expectedValue;
+  const T distance = std::fabs(actualValue - expectedValue);
+  const T scale = std::max(std::fabs(actualValue), std::fabs(expectedValue));
+  return actualValue == expectedValue ||
+         distance < static_cast<T>(tolerance.absoluteEpsilon) ||
+         distance <= static_cast<T>(tolerance.relativeEpsilon) * scale ||
+         (tolerance.maxUlps > 0 &&
+          ulpDistance(expectedValue, actualValue) <= tolerance.maxUlps);
+}
+
+/**
+ * Detect whether two values of different types can be compared with ==
+ */
+template <typename T1, typename T2, typename = void>
+struct IsEqualityComparable : std::false_type {};
+
+template <typename T1, typename T2>
+struct IsEqualityComparable<
+    T1, T2,
+    std::void_t<decltype(std::declval<const T1&>() == std::declval<const T2&>())>>
+    : std::is_convertible<decltype(std::declval<const T1&>() ==
+                                   std::declval<const T2&>()),
+                          bool> {};
+
+/**
+ * Values of different types are compared directly if they have a common
+ * operator==. Numbers and enums are still converted to the type of the
+ * actual value, so the floating point tolerance applies and narrowing
+ * conversions are rejected.
+ */
+template <typename T1, typename T2>
+constexpr bool isDirectlyComparable =
+    !std::is_arithmetic_v<T1> && !std::is_arithmetic_v<T2> &&
+    !std::is_enum_v<T1> && !std::is_enum_v<T2> &&
+    IsEqualityComparable<T1, T2>::value;
+
+/**
+ * Strings, string views and character arrays are compared as std::string_view.
+ * Character pointers are not included, they may be null.
+ */
+template <typename T>
+constexpr bool isString =
+    std::is_convertible_v<const T&, std::string_view> && !std::is_pointer_v<T>;
+
+/**
+ * Comparison function for different types
+ */
+template <typename T>
+bool isEqual(const T& t1, const T& t2) {
+  return t1 == t2;
+}
+
+/**
+ * Double values are equal if they are within the current tolerance, by
+ * default if they differ less than 1e-4
+ */
+template <>
+inline bool isEqual<double>(const double& expectedValue,
+                            const double& actualValue) {
+  return isClose(expectedValue, actualValue, currentTolerance());
+}
+
+/**
+ * Float values are equal if they are within the current tolerance, by
+ * default if they differ less than 1e-4
+ */
+template <>
+inline bool isEqual<float>(const float& expectedValue,
+                           const float& actualValue) {
+  return isClose(expectedValue, actualValue, currentTolerance());
+}
+
+/**
+ * Sink collecting everything in memory
+ */
+class StringSink : public Sink {
+ public:
+  void write(const char* data, std::size_t size) override {
+    text_.append(data, size);
+  }
+
+  const std::string& text() const { return text_; }
+
+  /**
+   * Return the text written so far and start with an empty one
+   */
+  std::string take() { return std::exchange(text_, std::string()); }
+
+ private:
+  std::string text_;
+};
+
+/**
+ * Lock-free list of values that are owned by one thread at a time.
+ * A thread acquires a slot on first use and releases it when it exits, the slot
+ * is then reused by the next thread. Slots are only deleted with the list, so
+ * forEach() can visit the values of threads that are still running.
+ */
+template <typename T>
+class ThreadSlots {
+ public:
+  /**
+   * Slots start on their own cache line, so the values of different threads
+   * do not share one
+   */
+  struct alignas(TEST_H_CACHE_LINE) Slot {
+    T value;
+    std::atomic<bool> inUse = true;
+    Slot* next = nullptr;
+  };
+
+  ThreadSlots() = default;
+  ThreadSlots(const ThreadSlots&) = delete;
+  ThreadSlots& operator=(const ThreadSlots&) = delete;
+
+  ~ThreadSlots() {
+    Slot* slot = head_.load();
+    while (slot != nullptr) {
+      Slot* next = slot->next;
+      delete slot;
+      slot = next;
+    }
+  }
+
+  Slot& acquire() {
+    for (Slot* slot = head_.load(std::memory_order_acquire); slot != nullptr;
+         slot = slot->next) {
+      bool expected = false;
+      if (!slot->inUse.load(std::memory_order_relaxed) &&
+          slot->inUse.compare_exchange_strong(expected, true,
+                                              std::memory_order_acquire))
+        return *slot;
+    }
+    Slot* slot = new Slot();
+    slot->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(slot->next, slot,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+    }
+    return *slot;
+  }
+
+  void release(Slot& slot) { slot.inUse.store(false, std::memory_order_release); }
+
+  template <typename Function>
+  void forEach(Function function) {
+    for (Slot* slot = head_.load(std::memory_order_acquire); slot != nullptr;
+         slot = slot->next)
+      function(slot->value);
+  }
+
+ private:
+  std::atomic<Slot*> head_ = nullptr;
+};
+
+/**
+ * Non-owning reference to a function that appends a message to a string
+ */
+class MessageFunction {
+ public:
+  template <typename Function>
+  MessageFunction(const Function& function)
+      : function_(&function), call_(&callErased<Function>) {}
+
+  void operator()(std::string& out) const { call_(function_, out); }
+
+ private:
+  template <typename Function>
+  static void callErased(const void* function, std::string& out) {
+    (*static_cast<const Function*>(function))(out);
+  }
+
+  const void* function_;
+  void (*call_)(const void*, std::string&);
+};
+
+/**
+ * Element-wise comparison used for ranges, the same as isEqual
+ */
+template <typename T>
+bool isEqualElement(const T& expectedValue, const T& actualValue,
+                    const Tolerance& tolerance) {
+  if constexpr (std::is_floating_point_v<T>)
+    return isClose(expectedValue, actualValue, tolerance);
+  else
+    return isEqual(expectedValue, actualValue);
+}
+
+/**
+ * Number of different elements in two arrays. The loop has no branches, so
+ * the compiler can vectorize it. float and double use the SIMD kernels of the
+ * implementation instead.
+ */
+template <typename T>
+std::size_t countMismatches(const T* expected, const T* actual,
+                            std::size_t size, const Tolerance& tolerance) {
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < size; ++i)
+    count += !isEqualElement(expected[i], actual[i], tolerance);
+  return count;
+}
+
+TEST_H_API std::size_t countMismatches(const float* expected,
+                                       const float* actual, std::size_t size,
+                                       const Tolerance& tolerance);
+TEST_H_API std::size_t countMismatches(const double* expected,
+                                       const double* actual, std::size_t size,
+                                       const Tolerance& tolerance);
+
+/**
+ * Result of one registered test while it runs on a thread of the runner
+ */
+struct TestResult {
+  const TestCase* testCase = nullptr;
+  std::uint64_t checks = 0;
+  std::uint64_t failures = 0;
+  /**
+   * If set, the reports of the checks are collected in output instead of the
+   * buffer of the thread, so the runner can print them in a fixed order
+   */
+  bool capture = false;
+  std::string output;
+  /**
+   * Wall time of the test, only measured if timing is enabled, a reporter is
+   * installed or the timings are recorded
+   */
+  double seconds = 0;
+  /**
+   * Hardware events of the thread running the test, only counted if enabled
+   * with Test::setPerfCounters()
+   */
+  PerfCounts counters;
+  /**
+   * Set if the test was not run because of the maximum number of failures
+   */
+  bool skipped = false;
+  /**
+   * Set while a case of a PROPERTY is tried. The checks are then only counted
+   * here, neither printed nor counted in the summary.
+   */
+  bool trial = false;
+  /**
+   * Set together with trial while the counterexample of a PROPERTY is
+   * replayed. Its failing checks are printed, but still only counted here.
+   */
+  bool replay = false;
+};
+
+/**
+ * FNV-1a hash of a test name, which is the same on every machine
+ */
+inline std::uint64_t hashName(std::string_view name) {
+  std::uint64_t hash = 14695981039346656037ull;
+  for (const char c : name) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+/**
+ * Node of the list of registered tests, a static object of the TEST and
+ * BENCHMARK macros
+ */
+struct TestNode {
+  TestCase testCase;
+  TestNode* next;
+};
+
+/**
+ * Registers a test during static initialization, created by the TEST and
+ * BENCHMARK macros. Without autorun, this only links the node into the list
+ * and neither constructs nor calls anything else.
+ */
+struct Registrar {
+  Registrar(TestNode& node, bool autorun);
+};
+
+/**
+ * Non-owning reference to a function that tries a case of a PROPERTY with
+ * the checks counted in trial, returns false if the case fails
+ */
+class CaseFunction {
+ public:
+  template <typename Function>
+  CaseFunction(const Function& function)
+      : function_(&function), call_(&callErased<Function>) {}
+
+  bool operator()(std::size_t index, TestResult& trial) const {
+    return call_(function_, index, trial);
+  }
+
+ private:
+  template <typename Function>
+  static bool callErased(const void* function, std::size_t index,
+                         TestResult& trial) {
+    return (*static_cast<const Function*>(function))(index, trial);
+  }
+
+  const void* function_;
+  bool (*call_)(const void*, std::size_t, TestResult&);
+};
+
+/**
+ * Compares the elements at actual with the elements of a golden file, an
+ * instance of compareGolden() for their type
+ */
+using GoldenComparison = bool (*)(const void* actual, std::size_t actualSize,
+                                  const void* expected,
+                                  std::size_t expectedSize,
+                                  const SourceLocation& location,
+                                  std::string_view source);
+
+// The templates of the checks reach the rest of the framework only through
+// the following functions, with the operands erased to Value or
+// MessageFunction. In split mode they are compiled once, in the file with
+// TEST_H_IMPLEMENTATION.
+
+/**
+ * Count a check whose operands were compared by the caller and report it
+ */
+TEST_H_API bool checkCompared(bool testResult, const Value& expectedValue,
+                              const Value& actualValue,
+                              const SourceLocation& location);
+
+/**
+ * Compare two strings without copying them. A failure shows both strings
+ * from shortly before the first difference if they are too long to be
+ * printed completely.
+ */
+TEST_H_API bool checkString(std::string_view expectedValue,
+                            std::string_view actualValue,
+                            const SourceLocation& location);
+
+/**
+ * Count a check whose result was computed by the caller. The message is
+ * only written, by appendMessage, if it is printed.
+ */
+TEST_H_API bool checkWithMessage(bool testResult,
+                                 const MessageFunction& appendMessage,
+                                 const SourceLocation& location);
+
+/**
+ * Called after a require() failed. Aborts the running test, or the program
+ * if the check is not part of a test run by the runner.
+ */
+[[noreturn]] TEST_H_API void requireFailed();
+
+/**
+ * Check the allocations of the thread since start against the allowed
+ * maximum
+ */
+TEST_H_API bool checkAllocations(const Allocations& start,
+                                 std::uint64_t maxAllocations,
+                                 const SourceLocation& location);
+
+/**
+ * Compare size elements at actual with the golden file name in the golden
+ * directory, or write the file in update mode. type and elementSize describe
+ * the elements, compare runs on the mapped file.
+ */
+TEST_H_API bool checkGoldenFile(std::string_view name, std::uint32_t type,
+                                std::size_t elementSize, const void* actual,
+                                std::size_t size, GoldenComparison compare,
+                                const SourceLocation& location);
+
+/**
+ * Attribute the checks of the calling thread to the given test, nullptr
+ * ends the attribution. Returns the previous test.
+ */
+TEST_H_API TestResult* setCurrentTest(TestResult* test);
+
+TEST_H_API TestResult* currentTest();
+
+/**
+ * Run the code of a STRESS_TEST on threads threads and report their
+ * throughput. The checks of all threads count for the running test.
+ */
+TEST_H_API void runStress(void (*function)(const Stress&), std::size_t threads,
+                          std::uint64_t iterations, const char* name);
+
+/**
+ * Try the cases 0 to cases - 1 of a property in batches, on the threads set
+ * with Test::setPropertyThreads(). Returns the first failing case, or cases
+ * if all of them pass.
+ */
+TEST_H_API std::size_t findFailure(std::size_t cases,
+                                   const TestCase* testCase,
+                                   const CaseFunction& tryCase);
+
+/**
+ * Run the counterexample of a property once more to print its failing
+ * checks, without counting them in the summary. An exception is reported
+ * as a failing check with its what() text instead of being rethrown.
+ */
+TEST_H_API void replayCase(const TestCase* testCase,
+                           const CaseFunction& replay);
+
+/**
+ * Create the instance of the framework if it does not exist yet, so it is
+ * destroyed after the static objects of the caller
+ */
+TEST_H_API void createInstance();
+
+/**
+ * Seconds of a steady clock, for the benchmarks. <chrono> is not included by
+ * the declarations, it is about as expensive as iostreams.
+ */
+TEST_H_API double steadySeconds();
+
+/**
+ * Print the counts of an InstanceCounter at the end of the program
+ */
+TEST_H_API void reportInstances(const char* type, std::int64_t live,
+                                std::int64_t total, std::int64_t peak,
+                                std::size_t size);
+
+/**
+ * Test two values for equality and output the result. Values of the same
+ * type are compared with isEqual(), so the floating point tolerance applies.
+ */
+template <typename T1, typename T2>
+bool checkEqual(const T1& expectedValue, const T2& actualValue,
+                const SourceLocation& location) {
+  bool testResult;
+  if constexpr (std::is_same_v<T1, T2>)
+    testResult = isEqual(expectedValue, actualValue);
+  else
+    testResult = static_cast<bool>(expectedValue == actualValue);
+  return checkCompared(testResult, Value(expectedValue), Value(actualValue),
+                       location);
+}
+
+/**
+ * Compare two values of possibly different types for check() and require()
+ */
+template <typename T1, typename T2>
+bool checkValues(const T1& actualValue, const T2& expectedValue,
+                 const SourceLocation& location) {
+  if constexpr (isString<T1> && isString<T2>) {
+    // std::string, std::string_view and character arrays in any combination
+    return checkString(expectedValue, actualValue, location);
+  } else if constexpr (std::is_same_v<T1, T2>) {
+    return checkEqual(expectedValue, actualValue, location);
+  } else if constexpr (std::is_same_v<T1, double> &&
+                       std::is_same_v<T2, int>) {
+    // allow conversion from int to double explicitely
+    return checkEqual(static_cast<double>(expectedValue), actualValue,
+                      location);
+  } else if constexpr (isDirectlyComparable<T1, T2>) {
+    // e.g. std::string and const char*, no temporary needed
+    return checkEqual(expectedValue, actualValue, location);
+  } else {
+    const T1& expectedValueCasted{
+        expectedValue};  // allows conversion in general, but avoids narrowing
+                         // conversion
+    return checkEqual(expectedValueCasted, actualValue, location);
+  }
+}
+
+/**
+ * Compare two arrays as a single check. The arrays are processed in blocks
+ * with the vectorized countMismatches(), only blocks with differences are
+ * searched for the indexes to report.
+ */
+template <typename T>
+bool checkRange(const T* actual, std::size_t actualSize, const T* expected,
+                std::size_t expectedSize, const SourceLocation& location,
+                std::string_view source = {}) {
+  constexpr std::size_t blockSize = 1024;
+  const std::size_t size = std::min(actualSize, expectedSize);
+  const Tolerance& tolerance = currentTolerance();
+  std::size_t mismatches = 0;
+  std::size_t reported[TEST_H_MAX_MISMATCHES];
+  std::size_t numReported = 0;
+  for (std::size_t begin = 0; begin < size; begin += blockSize) {
+    const std::size_t length = std::min(blockSize, size - begin);
+    const std::size_t count =
+        countMismatches(expected + begin, actual + begin, length, tolerance);
+    for (std::size_t i = begin; count > 0 && i < begin + length &&
+                                numReported < TEST_H_MAX_MISMATCHES;
+         ++i) {
+      if (!isEqualElement(expected[i], actual[i], tolerance))
+        reported[numReported++] = i;
+    }
+    mismatches += count;
+  }
+
+  const bool testResult = mismatches == 0 && actualSize == expectedSize;
+  return checkWithMessage(testResult, [&](std::string& out) {
+    // where the expected values come from
+    if (!source.empty()) {
+      out += source;
+      out += ": ";
+    }
+    if (testResult) {
+      out += "All ";
+      appendNumber(out, size);
+      out += " elements are equal";
+      return;
+    }
+    if (actualSize != expectedSize) {
+      out += "expected ";
+      appendNumber(out, expectedSize);
+      out += " elements, but actual range has ";
+      appendNumber(out, actualSize);
+      out += mismatches > 0 ? ", and " : "";
+    }
+    if (mismatches > 0) {
+      appendNumber(out, mismatches);
+      out += " of ";
+      appendNumber(out, size);
+      out += " elements differ";
+    }
+    for (std::size_t i = 0; i < numReported; ++i) {
+      out += "\n  at index ";
+      appendNumber(out, reported[i]);
+      out += ": expected value ";
+      appendQuoted(out, expected[reported[i]]);
+      out += ", but actual value was ";
+      appendQuoted(out, actual[reported[i]]);
+    }
+    if (mismatches > numReported)
+      out += "\n  ...";
+  }, location);
+}
+
+/**
+ * Kind and size of the elements, so a file is not read with the wrong type
+ */
+template <typename T>
+constexpr std::uint32_t goldenType() {
+  const std::uint32_t kind = std::is_floating_point_v<T> ? 2
+                             : std::is_signed_v<T>       ? 1
+                                                         : 0;
+  return kind << 8 | static_cast<std::uint32_t>(sizeof(T));
+}
+
+/**
+ * The comparison of checkGolden() for elements of type T
+ */
+template <typename T>
+bool compareGolden(const void* actual, std::size_t actualSize,
+                   const void* expected, std::size_t expectedSize,
+                   const SourceLocation& location, std::string_view source) {
+  return checkRange(static_cast<const T*>(actual), actualSize,
+                    static_cast<const T*>(expected), expectedSize, location,
+                    source);
+}
+
+/**
+ * Compare the elements with the golden file name in the golden directory, or
+ * write the file in update mode. The comparison runs on the mapped file.
+ */
+template <typename T>
+bool checkGolden(std::string_view name, const T* actual, std::size_t size,
+                 const SourceLocation& location) {
+  static_assert(std::is_arithmetic_v<T>,
+                "golden files hold elements of arithmetic types");
+  return checkGoldenFile(name, goldenType<T>(), sizeof(T), actual, size,
+                         &compareGolden<T>, location);
+}
+
+/**
+ * Counts the instances of T for InstanceCounter<T> and reports them at the
+ * end of the program. With TEST_H_PER_THREAD_COUNTERS, every thread counts in
+ * its own slot with plain increments. A slot is merged into the shared
+ * counters after every batchSize objects it created, when its thread exits
+ * and at the end of the program. The peak is then exact as long as only one
+ * thread creates objects, otherwise it may be off by the objects of other
+ * threads that are not merged yet.
+ */
+template <typename T>
+class InstanceCounterHelper {
+ public:
+  struct Deltas {
+    std::atomic<std::int64_t> count = 0;
+    std::atomic<std::int64_t> total = 0;
+    std::atomic<std::int64_t> peak = 0;  // highest count since the last merge
+  };
+
+  /**
+   * Make sure the Test instance exists first, so it is destroyed after the
+   * helper and can still write the report.
+   */
+  InstanceCounterHelper() { createInstance(); }
+
+  ~InstanceCounterHelper() {
+    reportInstances(typeid(T).name(), live(), total(), peak(), sizeof(T));
+  }
+
+  static InstanceCounterHelper& instance() {
+    static InstanceCounterHelper helper;
+    return helper;
+  }
+
+  static void increment() {
+#if TEST_H_PER_THREAD_COUNTERS
+    Deltas& deltas = threadDeltas();
+    const std::int64_t count = add(deltas.count, 1);
+    if (count > deltas.peak.load(std::memory_order_relaxed))
+      deltas.peak.store(count, std::memory_order_relaxed);
+    if (add(deltas.total, 1) >= batchSize)
+      instance().merge(deltas);
+#else
+    InstanceCounterHelper& helper = instance();
+    helper.updatePeak(++helper.count_);
+    helper.total_++;
+#endif
+  }
+
+  static void decrement() {
+#if TEST_H_PER_THREAD_COUNTERS
+    add(threadDeltas().count, -1);
+#else
+    instance().count_--;
+#endif
+  }
+
+  /**
+   * Number of objects alive right now
+   */
+  std::int64_t live() {
+    std::int64_t count = count_.load();
+    slots_.forEach([&](Deltas& deltas) { count += deltas.count.load(); });
+    return count;
+  }
+
+  /**
+   * Number of objects created so far
+   */
+  std::int64_t total() {
+    std::int64_t total = total_.load();
+    slots_.forEach([&](Deltas& deltas) { total += deltas.total.load(); });
+    return total;
+  }
+
+  /**
+   * Highest number of objects alive at the same time so far
+   */
+  std::int64_t peak() {
+    std::int64_t peak = count_.load();
+    slots_.forEach([&](Deltas& deltas) { peak += deltas.peak.load(); });
+    return std::max(peak_.load(), peak);
+  }
+
+ private:
+  using Slot = typename ThreadSlots<Deltas>::Slot;
+
+  static constexpr std::int64_t batchSize = 1024;
+
+  /**
+   * Merges the deltas of a thread when it exits
+   */
+  struct ThreadHandle {
+    Slot* slot = nullptr;
+    ~ThreadHandle() {
+      if (slot != nullptr)
+        instance().releaseDeltas(*slot);
+      threadDeltas_ = nullptr;
+      threadExited_ = true;
+    }
+  };
+
+  /**
+   * Deltas are only written by their thread, a load and a store suffice.
+   * Returns the new value.
+   */
+  static std::int64_t add(std::atomic<std::int64_t>& counter,
+                          std::int64_t value) {
+    const std::int64_t result =
+        counter.load(std::memory_order_relaxed) + value;
+    counter.store(result, std::memory_order_relaxed);
+    return result;
+  }
+
+  static Deltas& threadDeltas() {
+    Deltas* deltas = threadDeltas_;
+    if (deltas == nullptr)
+      deltas = &acquireDeltas();
+    return *deltas;
+  }
+
+  /**
+   * Objects created or destroyed by a thread after its thread_local handle
+   * are counted in a slot that is only read at the end of the program.
+   */
+  static Deltas& acquireDeltas() {
+    Slot& slot = instance().slots_.acquire();
+    if (!threadExited_) {
+      static thread_local ThreadHandle handle;
+      handle.slot = &slot;
+    }
+    threadDeltas_ = &slot.value;
+    return slot.value;
+  }
+
+  void updatePeak(std::int64_t count) {
+    std::int64_t peak = peak_.load(std::memory_order_relaxed);
+    while (count > peak &&
+           !peak_.compare_exchange_weak(peak, count, std::memory_order_relaxed)) {
+    }
+  }
+
+  /**
+   * Move the deltas of a thread to the shared counters
+   */
+  void merge(Deltas& deltas) {
+    const std::int64_t count = deltas.count.exchange(0);
+    const std::int64_t peak = deltas.peak.exchange(0);
+    updatePeak(count_.fetch_add(count) + peak);
+    total_ += deltas.total.exchange(0);
+  }
+
+  void releaseDeltas(Slot& slot) {
+    merge(slot.value);
+    slots_.release(slot);
+  }
+
+  std::atomic<std::int64_t> count_ = 0;
+  std::atomic<std::int64_t> total_ = 0;
+  std::atomic<std::int64_t> peak_ = 0;
+  ThreadSlots<Deltas> slots_;
+  static inline thread_local Deltas* threadDeltas_ = nullptr;
+  static inline thread_local bool threadExited_ = false;
+};
+
+}  // namespace Test::Detail
+
+namespace Test {
+
+/**
+ * Prevent the compiler from optimizing away the computation of a value in a
+ * benchmark
+ */
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  const volatile char* pointer = reinterpret_cast<const volatile char*>(&value);
+  (void)*pointer;
+  _ReadWriteBarrier();
+#endif
+}
+
+/**
+ * Force the compiler to write all pending stores to memory
+ */
+inline void clobberMemory() {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : : "memory");
+#else
+  _ReadWriteBarrier();
+#endif
+}
+
+/**
+ * Counts cycles, instructions, cache misses and branch misses of the calling
+ * thread from construction until read(), with perf_event_open() on Linux.
+ * Elsewhere, or where the system does not allow it (e.g. in most virtual
+ * machines, or see /proc/sys/kernel/perf_event_paranoid), available() is
+ * false and all counts stay 0.
+ *
+ *   Test::PerfCounters counters;
+ *   kernel(data);
+ *   check(counters.read().cacheMisses < 1000);
+ */
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  bool available() const { return events_[0] >= 0; }
+
+  /**
+   * The counts since construction
+   */
+  PerfCounts read() const;
+
+ private:
+  void release();
+
+  // file descriptors of the events, the first one leads the group
+  int events_[4] = {-1, -1, -1, -1};
+};
+
+/**
+ * Statistics of a benchmark, times in nanoseconds per iteration
+ */
+struct BenchmarkResult {
+  std::uint64_t iterations = 0;  // per sample
+  std::vector<double> samples;
+  double median = 0;
+  double min = 0;
+  double mean = 0;
+  double stddev = 0;
+  double bytesPerSecond = 0;
+  double itemsPerSecond = 0;
+};
+
+/**
+ * Measures the run time of a function, passed to the code of the BENCHMARK
+ * macro as variable benchmark.
+ *
+ * run() first calls the function repeatedly for a short warmup, then doubles
+ * the number of iterations until one sample takes long enough to be measured
+ * reliably, and finally measures the given number of samples. The statistics
+ * are printed and available in result().
+ */
+class Benchmark {
+ public:
+  explicit Benchmark(const char* name) : name_(name) {}
+
+  /**
+   * Report the throughput in bytes or items per second, based on the amount
+   * processed by one call of the function
+   */
+  void setBytesPerIteration(std::uint64_t bytes) { bytesPerIteration_ = bytes; }
+  void setItemsPerIteration(std::uint64_t items) { itemsPerIteration_ = items; }
+
+  /**
+   * Total time in seconds spent in the measured samples, 0.5 by default
+   */
+  void setMinTime(double seconds) { minTime_ = seconds; }
+
+  void setSamples(unsigned samples) { samples_ = samples > 0 ? samples : 1; }
+
+  template <typename Function>
+  const BenchmarkResult& run(Function&& function) {
+    const double sampleTime = minTime_ / samples_;
+
+    double elapsed = 0;
+    for (std::uint64_t iterations = 1; elapsed < sampleTime / 2;
+         iterations *= 2)
+      elapsed += measure(function, iterations);
+
+    std::uint64_t iterations = 1;
+    for (;;) {
+      elapsed = measure(function, iterations);
+      if (elapsed >= sampleTime || iterations >= (std::uint64_t(1) << 40))
+        break;
+      // aim a bit above the target, but grow at most by a factor of 10
+      const double factor = elapsed > 0 ? 1.2 * sampleTime / elapsed : 10;
+      iterations = static_cast<std::uint64_t>(
+          iterations * std::min(10.0, std::max(2.0, factor)));
+    }
+
+    result_ = BenchmarkResult();
+    result_.iterations = iterations;
+    for (unsigned i = 0; i < samples_; ++i)
+      result_.samples.push_back(measure(function, iterations) * 1e9 /
+                                iterations);
+    evaluate();
+    report();
+    return result_;
+  }
+
+  const BenchmarkResult& result() const { return result_; }
+
+ private:
+  template <typename Function>
+  static double measure(Function& function, std::uint64_t iterations) {
+    const double start = Detail::steadySeconds();
+    for (std::uint64_t i = 0; i < iterations; ++i)
+      function();
+    return Detail::steadySeconds() - start;
+  }
+
+  void evaluate();
+
+  void report();
+
+  const char* name_;
+  std::uint64_t bytesPerIteration_ = 0;
+  std::uint64_t itemsPerIteration_ = 0;
+  double minTime_ = 0.5;
+  unsigned samples_ = 10;
+  BenchmarkResult result_;
+};
+
+/**
+ * Source of random numbers for the generators of PROPERTY (SplitMix64)
+ */
+class Random {
+ public:
+  explicit Random(std::uint64_t seed) : state_(seed) {}
+
+  std::uint64_t next() { return mix(state_ += 0x9e3779b97f4a7c15ull); }
+
+  /**
+   * Uniformly distributed in [0, bound), bound must not be 0
+   */
+  std::uint64_t below(std::uint64_t bound) { return next() % bound; }
+
+  /**
+   * Uniformly distributed in [0, 1)
+   */
+  double uniform() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+
+  /**
+   * Scramble the bits of a number, e.g. to derive independent seeds
+   */
+  static std::uint64_t mix(std::uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+ private:
+  std::uint64_t state_;
+};
+
+/**
+ * Creates the random arguments of a PROPERTY and simpler candidates to shrink
+ * a failing one. Specialize it for other types with the two functions
+ *   static T generate(Random& random, std::size_t size);
+ *   static std::vector<T> shrink(const T& value);
+ * The size grows from 0 to 100 over the cases, so the first cases are small.
+ * The candidates are tried in order and must be simpler than the value, so
+ * shrinking ends.
+ */
+template <typename T, typename Enable = void>
+struct Generator;
+
+template <>
+struct Generator<bool> {
+  static bool generate(Random& random, std::size_t) {
+    return (random.next() & 1) != 0;
+  }
+
+  static std::vector<bool> shrink(bool value) {
+    return value ? std::vector<bool>{false} : std::vector<bool>{};
+  }
+};
+
+/**
+ * Integers with up to size percent of the bits, and now and then one of the
+ * limits of the type
+ */
+template <typename T>
+struct Generator<T, std::enable_if_t<std::is_integral_v<T> &&
+                                     !std::is_same_v<T, bool>>> {
+  static T generate(Random& random, std::size_t size) {
+    if (random.below(16) == 0) {
+      const T limits[] = {T(0), T(1), std::numeric_limits<T>::min(),
+                          std::numeric_limits<T>::max()};
+      return limits[random.below(4)];
+    }
+    constexpr int digits = std::numeric_limits<T>::digits;
+    const int bits =
+        1 + static_cast<int>(std::min<std::size_t>(size, 100) *
+                             static_cast<std::size_t>(digits - 1) / 100);
+    const std::uint64_t mask =
+        bits >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+    T value = static_cast<T>(random.next() & mask);
+    if constexpr (std::is_signed_v<T>) {
+      if ((random.next() & 1) != 0)
+        value = static_cast<T>(-value);
+    }
+    return value;
+  }
+
+  /**
+   * 0, the positive value and values between the value and 0
+   */
+  static std::vector<T> shrink(T value) {
+    std::vector<T> candidates;
+    if (value == 0)
+      return candidates;
+    candidates.push_back(0);
+    if constexpr (std::is_signed_v<T>) {
+      if (value < 0 && value != std::numeric_limits<T>::min())
+        candidates.push_back(static_cast<T>(-value));
+    }
+    for (T difference = static_cast<T>(value / 2); difference != 0;
+         difference = static_cast<T>(difference / 2))
+      candidates.push_back(static_cast<T>(value - difference));
+    return candidates;
+  }
+};
+
+/**
+ * Finite numbers with an exponent range that grows with the size, and now and
+ * then one of the special values of the type
+ */
+template <typename T>
+struct Generator<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+  static T generate(Random& random, std::size_t size) {
+    if (random.below(16) == 0) {
+      const T limits[] = {T(0),
+                          T(1),
+                          T(-1),
+                          std::numeric_limits<T>::epsilon(),
+                          std::numeric_limits<T>::min(),
+                          std::numeric_limits<T>::max(),
+                          std::numeric_limits<T>::lowest()};
+      return limits[random.below(std::size(limits))];
+    }
+    constexpr int maxExponent = std::numeric_limits<T>::max_exponent - 1;
+    const int range =
+        1 + static_cast<int>(std::min<std::size_t>(size, 100) * maxExponent /
+                             100);
+    const int exponent =
+        static_cast<int>(random.below(2 * static_cast<std::uint64_t>(range) +
+                                      1)) -
+        range;
+    return std::ldexp(static_cast<T>(2 * random.uniform() - 1), exponent);
+  }
+
+  /**
+   * 0, the positive value, the integral part and half of the value
+   */
+  static std::vector<T> shrink(T value) {
+    std::vector<T> candidates;
+    if (value == 0 || !std::isfinite(value))
+      return candidates;
+    candidates.push_back(0);
+    if (value < 0)
+      candidates.push_back(-value);
+    const T integral = std::trunc(value);
+    if (integral != value && integral != 0)
+      candidates.push_back(integral);
+    if (std::abs(value) > 1)
+      candidates.push_back(value / 2);
+    return candidates;
+  }
+};
+
+/**
+ * Strings of up to size characters, mostly printable ASCII
+ */
+template <>
+struct Generator<std::string> {
+  static std::string generate(Random& random, std::size_t size) {
+    std::string value(random.below(size + 1), ' ');
+    for (char& c : value) {
+      c = random.below(8) != 0 ? static_cast<char>(' ' + random.below(95))
+                               : static_cast<char>(random.below(256));
+    }
+    return value;
+  }
+
+  /**
+   * The empty string, both halves, and for the first characters the string
+   * without the character or with the character replaced by 'a'
+   */
+  static std::vector<std::string> shrink(const std::string& value) {
+    constexpr std::size_t maxPositions = 32;
+    std::vector<std::string> candidates;
+    if (value.empty())
+      return candidates;
+    candidates.emplace_back();
+    if (value.size() == 1 && value[0] != 'a')
+      candidates.emplace_back("a");
+    if (value.size() == 1)
+      return candidates;
+    candidates.push_back(value.substr(0, value.size() / 2));
+    candidates.push_back(value.substr(value.size() / 2));
+    const std::size_t positions = std::min(value.size(), maxPositions);
+    for (std::size_t i = 0; i < positions; ++i)
+      candidates.push_back(value.substr(0, i) + value.substr(i + 1));
+    for (std::size_t i = 0; i < positions; ++i) {
+      if (value[i] != 'a') {
+        candidates.push_back(value);
+        candidates.back()[i] = 'a';
+      }
+    }
+    return candidates;
+  }
+};
+
+}  // namespace Test
+
+namespace Test::Detail {
+
+/**
+ * Settings of PROPERTY, read from the environment on first use
+ */
+class PropertyOptions {
+ public:
+  static PropertyOptions& instance() {
+    static PropertyOptions options;
+    return options;
+  }
+
+  std::atomic<std::size_t> cases = 100;
+  std::atomic<unsigned> threads = 0;
+  std::atomic<std::uint64_t> seed = 0;
+
+ private:
+  PropertyOptions() {
+    if (const char* value = std::getenv("TEST_H_PROPERTY_CASES"))
+      cases = std::max<std::size_t>(1, std::strtoull(value, nullptr, 10));
+    if (const char* value = std::getenv("TEST_H_PROPERTY_THREADS"))
+      threads = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+    if (const char* value = std::getenv("TEST_H_SEED"))
+      seed = std::strtoull(value, nullptr, 10);
+  }
+};
+
+template <typename Arguments, std::size_t... I>
+Arguments generateArguments(Random& random, std::size_t size,
+                            std::index_sequence<I...>) {
+  // a braced list is evaluated from left to right
+  return Arguments{
+      Generator<std::tuple_element_t<I, Arguments>>::generate(random, size)...};
+}
+
+/**
+ * Arguments of case index of a property. Each case has its own random
+ * numbers, so the arguments do not depend on the order of evaluation.
+ */
+template <typename Arguments>
+Arguments generateCase(std::uint64_t seed, std::size_t index,
+                       std::size_t cases) {
+  Random random(seed ^ Random::mix(index + 1));
+  return generateArguments<Arguments>(
+      random, index * 100 / cases,
+      std::make_index_sequence<std::tuple_size_v<Arguments>>());
+}
+
+/**
+ * Try one case with the checks only counted in trial. Returns whether all
+ * checks passed and no exception was thrown.
+ */
+template <typename Function, typename Arguments>
+bool tryCase(Function function, Arguments arguments, TestResult& trial) {
+  trial.checks = 0;
+  trial.failures = 0;
+  TestResult* previous = setCurrentTest(&trial);
+  bool threw = false;
+  try {
+    std::apply(function, arguments);
+  } catch (...) {
+    threw = true;
+  }
+  setCurrentTest(previous);
+  return !threw && trial.failures == 0;
+}
+
+/**
+ * Replace argument I of a failing case by the first simpler candidate that
+ * fails as well. Returns false if there is none or no attempts are left.
+ */
+template <std::size_t I, typename Function, typename Arguments>
+bool shrinkArgument(Function function, Arguments& failing, TestResult& trial,
+                    std::size_t& attempts) {
+  using T = std::tuple_element_t<I, Arguments>;
+  for (auto&& candidate : Generator<T>::shrink(std::get<I>(failing))) {
+    if (attempts == 0)
+      return false;
+    --attempts;
+    Arguments next = failing;
+    std::get<I>(next) = candidate;
+    if (!tryCase(function, next, trial)) {
+      failing = std::move(next);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Function, typename Arguments, std::size_t... I>
+bool shrinkCase(Function function, Arguments& failing, TestResult& trial,
+                std::size_t& attempts, std::index_sequence<I...>) {
+  return (shrinkArgument<I>(function, failing, trial, attempts) || ...);
+}
+
+/**
+ * Run a property for the configured number of cases. The cases are tried
+ * in batches on several threads without printing or counting their checks.
+ * The first failing case is shrunk one argument at a time and the smallest
+ * counterexample is reported as one failing check, followed by the failing
+ * checks of that case in the usual format. A property that holds counts as
+ * one passing check.
+ */
+template <typename... Parameters>
+void checkProperty(void (*function)(Parameters...), const char* parameters,
+                   const SourceLocation& location) {
+  using Arguments = std::tuple<std::decay_t<Parameters>...>;
+  constexpr std::size_t maxShrinkAttempts = 10000;
+  const PropertyOptions& options = PropertyOptions::instance();
+  const std::size_t cases = options.cases.load();
+  const std::uint64_t globalSeed = options.seed.load();
+  const TestResult* current = currentTest();
+  const TestCase* testCase = current != nullptr ? current->testCase : nullptr;
+  const std::uint64_t seed =
+      Random::mix(globalSeed ^ hashName(testCase != nullptr ? testCase->name
+                                                            : parameters));
+
+  const std::size_t failure = findFailure(
+      cases, testCase, [&](std::size_t index, TestResult& trial) {
+        return tryCase(function, generateCase<Arguments>(seed, index, cases),
+                       trial);
+      });
+  if (failure == cases) {
+    checkWithMessage(
+        true,
+        [&](std::string& out) {
+          out += "property held for ";
+          appendNumber(out, cases);
+          out += " random cases";
+        },
+        location);
+    return;
+  }
+
+  Arguments failing = generateCase<Arguments>(seed, failure, cases);
+  TestResult trial;
+  trial.testCase = testCase;
+  trial.trial = true;
+  std::size_t attempts = maxShrinkAttempts;
+  std::size_t shrinks = 0;
+  while (shrinkCase(function, failing, trial, attempts,
+                    std::index_sequence_for<Parameters...>()))
+    ++shrinks;
+
+  checkWithMessage(
+      false,
+      [&](std::string& out) {
+        out += "property falsified by (";
+        out += parameters;
+        out += ") = (";
+        std::apply(
+            [&out](const auto&... argument) {
+              const char* separator = "";
+              ((out += separator, appendQuoted(out, argument),
+                separator = ", "),
+               ...);
+            },
+            failing);
+        out += ") in case ";
+        appendNumber(out, failure);
+        out += " of ";
+        appendNumber(out, cases);
+        out += " after ";
+        appendNumber(out, shrinks);
+        out += " shrinks, TEST_H_SEED=";
+        appendNumber(out, globalSeed);
+      },
+      location);
+  replayCase(testCase, [&](std::size_t, TestResult&) {
+    std::apply(function, failing);
+    return true;
+  });
+}
+
+}  // namespace Test::Detail
+
+/**
+ * Count the instances of a class T.
+ * Result gets printed automatically at the end of the program.
+ * To use it, inherit T from InstanceCounter<T>, e.g.
+ * class MyClass : InstanceCounter<MyClass>
+ */
+template <typename T>
+class InstanceCounter {
+ public:
+  InstanceCounter() { Helper::increment(); }
+
+  InstanceCounter(const InstanceCounter&) { Helper::increment(); }
+
+  InstanceCounter(const InstanceCounter&&) { Helper::increment(); }
+
+  virtual ~InstanceCounter() { Helper::decrement(); }
+
+  Test::Detail::InstanceCounterHelper<T>& counter() {
+    return Helper::instance();
+  }
+
+  /**
+   * Number of instances alive right now
+   */
+  static std::int64_t live() { return Helper::instance().live(); }
+
+  /**
+   * Highest number of instances alive at the same time so far
+   */
+  static std::int64_t peak() { return Helper::instance().peak(); }
+
+  /**
+   * Number of instances created so far
+   */
+  static std::int64_t total() { return Helper::instance().total(); }
+
+  /**
+   * Memory in bytes used by the live instances, without heap memory they own
+   */
+  static std::int64_t bytes() {
+    return live() * static_cast<std::int64_t>(sizeof(T));
+  }
+
+ private:
+  using Helper = Test::Detail::InstanceCounterHelper<T>;
+};
+
+/**
+ * Check if the expected value is equal to the actual value.
+ * Result is printed on the command line and at the end of the program, a
+ * summary of all tests is printed.
+ */
+template <typename T1, typename T2,
+          typename = std::enable_if_t<!std::is_same_v<T2, Test::SourceLocation>>>
+void check(const T1& actualValue, const T2& expectedValue,
+           const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  Test::Detail::checkValues(actualValue, expectedValue, location);
+}
+
+/**
+ * Check if the entered value is true.
+ * Result is printed on the command line and at the end of the program, a
+ * summary of all tests is printed.
+ */
+inline void check(bool a,
+                  const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  Test::Detail::checkValues(a, true, location);
+}
+
+/**
+ * Like check(), but a failure aborts the running TEST. Outside of a test run
+ * by the runner, a failure ends the program.
+ */
+template <typename T1, typename T2,
+          typename = std::enable_if_t<!std::is_same_v<T2, Test::SourceLocation>>>
+void require(const T1& actualValue, const T2& expectedValue,
+             const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  if (!Test::Detail::checkValues(actualValue, expectedValue, location))
+    Test::Detail::requireFailed();
+}
+
+inline void require(
+    bool a, const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  if (!Test::Detail::checkValues(a, true, location))
+    Test::Detail::requireFailed();
+}
+
+namespace Test {
+
+/**
+ * Set the tolerance of all floating point checks that are not within a
+ * Test::ToleranceScope. Should be called before checks run on other threads.
+ */
+inline void setTolerance(const Tolerance& tolerance) {
+  Detail::globalTolerance = tolerance;
+}
+
+/**
+ * Use a different tolerance for the floating point checks of the calling
+ * thread until the scope ends.
+ *
+ * Usage:
+ * {
+ *   Test::ToleranceScope scope(Test::Tolerance::ulps(2));
+ *   check(a, b);
+ * }
+ */
+class ToleranceScope {
+ public:
+  explicit ToleranceScope(const Tolerance& tolerance)
+      : tolerance_(tolerance), previous_(Detail::scopedTolerance) {
+    Detail::scopedTolerance = &tolerance_;
+  }
+
+  ToleranceScope(const ToleranceScope&) = delete;
+  ToleranceScope& operator=(const ToleranceScope&) = delete;
+
+  ~ToleranceScope() { Detail::scopedTolerance = previous_; }
+
+ private:
+  Tolerance tolerance_;
+  const Tolerance* previous_;
+};
+
+/**
+ * Check at the end of the scope that the thread did not call operator new
+ * more than maxAllocations times within it. NO_ALLOC_SCOPE allows none.
+ *
+ * Usage:
+ * {
+ *   Test::AllocationScope scope(1);
+ *   v.push_back(x);
+ * }
+ */
+class AllocationScope {
+ public:
+  explicit AllocationScope(
+      std::uint64_t maxAllocations,
+      const SourceLocation& location = TEST_H_CURRENT_LOCATION)
+      : maxAllocations_(maxAllocations),
+        location_(location),
+        start_(Detail::threadAllocations) {}
+
+  AllocationScope(const AllocationScope&) = delete;
+  AllocationScope& operator=(const AllocationScope&) = delete;
+
+  ~AllocationScope() {
+    Detail::checkAllocations(start_, maxAllocations_, location_);
+  }
+
+ private:
+  std::uint64_t maxAllocations_;
+  SourceLocation location_;
+  Allocations start_;
+};
+
+}  // namespace Test
+
+/**
+ * Check two floating point values with the given tolerance instead of the
+ * current one
+ */
+template <typename T1, typename T2>
+void check(const T1& actualValue, const T2& expectedValue,
+           const Test::Tolerance& tolerance,
+           const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  static_assert(std::is_floating_point_v<T1>,
+                "a tolerance can only be used for floating point values");
+  Test::ToleranceScope scope(tolerance);
+  check(actualValue, expectedValue, location);
+}
+
+/**
+ * Check if two contiguous containers (std::vector, std::array, C arrays,
+ * ...) hold the same elements. Floating point elements are compared like in
+ * check(). The comparison counts as one check, if it fails, the first
+ * TEST_H_MAX_MISMATCHES differing elements are printed.
+ */
+template <typename Range1, typename Range2>
+void check_range(
+    const Range1& actualValues, const Range2& expectedValues,
+    const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  using T = std::remove_cv_t<
+      std::remove_reference_t<decltype(*std::data(actualValues))>>;
+  using U = std::remove_cv_t<
+      std::remove_reference_t<decltype(*std::data(expectedValues))>>;
+  static_assert(std::is_same_v<T, U>,
+                "check_range() needs ranges of the same element type");
+  Test::Detail::checkRange<T>(std::data(actualValues), std::size(actualValues),
+                              std::data(expectedValues),
+                              std::size(expectedValues), location);
+}
+
+template <typename Range, typename T>
+void check_range(
+    const Range& actualValues, std::initializer_list<T> expectedValues,
+    const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  check_range(actualValues, std::vector<T>(expectedValues), location);
+}
+
+template <typename Range1, typename Range2>
+void check_range(
+    const Range1& actualValues, const Range2& expectedValues,
+    const Test::Tolerance& tolerance,
+    const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  Test::ToleranceScope scope(tolerance);
+  check_range(actualValues, expectedValues, location);
+}
+
+/**
+ * Check if the arrays at actualValues and expectedValues hold the same size
+ * elements, like check_range()
+ */
+template <typename T>
+void check_span(const T* actualValues, const T* expectedValues,
+                std::size_t size,
+                const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  Test::Detail::checkRange<T>(actualValues, size, expectedValues, size,
+                              location);
+}
+
+/**
+ * Compare a contiguous container of arithmetic values with the reference
+ * values in the binary golden file name.golden, like check_range(). The file
+ * is mapped into memory instead of being parsed. With --update-golden or
+ * TEST_H_UPDATE_GOLDEN=1 the file is written instead.
+ */
+template <typename Range>
+void check_golden(
+    std::string_view name, const Range& actualValues,
+    const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  using T = std::remove_cv_t<
+      std::remove_reference_t<decltype(*std::data(actualValues))>>;
+  Test::Detail::checkGolden<T>(name, std::data(actualValues),
+                               std::size(actualValues), location);
+}
+
+template <typename T>
+void check_golden(
+    std::string_view name, const T* actualValues, std::size_t size,
+    const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  Test::Detail::checkGolden<T>(name, actualValues, size, location);
+}
+
+/**
+ * Check that function calls operator new at most maxAllocations times.
+ * Requires TEST_H_TRACK_ALLOCATIONS in one source file.
+ */
+template <typename Function>
+void check_allocations(
+    std::uint64_t maxAllocations, Function function,
+    const Test::SourceLocation& location = TEST_H_CURRENT_LOCATION) {
+  const Test::Allocations start = Test::Detail::threadAllocations;
+  function();
+  Test::Detail::checkAllocations(start, maxAllocations, location);
+}
+
+namespace Test {
+
+/**
+ * Set the amount of output at runtime. The default is Verbosity::Normal, or
+ * Verbosity::Quiet if TEST_H_QUIET is defined.
+ */
+TEST_H_API void setVerbosity(Verbosity verbosity);
+
+/**
+ * Redirect all output into the given sink. The sink must stay alive until the
+ * end of the program. nullptr restores the default sink writing to std::cout.
+ */
+TEST_H_API void setSink(Sink* sink);
+
+/**
+ * Flush the output sink after every failing check (the default), so that
+ * failures show up immediately even though output is buffered.
+ */
+TEST_H_API void setFlushOnFailure(bool flushOnFailure);
+
+/**
+ * Format and write the output on a background thread (also enabled with
+ * TEST_H_ASYNC=1). Checks of numbers and enums then only copy their operands
+ * into a lock-free queue, all other output is queued as text. Call it before
+ * checks run on several threads.
+ */
+TEST_H_API void setAsync(bool async);
+
+/**
+ * Hand the buffered output of the calling thread to the sink. Useful when
+ * mixing check() with own output on std::cout.
+ */
+TEST_H_API void flush();
+
+/**
+ * Number of checks executed and failed so far, summed over all threads
+ */
+TEST_H_API Summary summary();
+
+#ifdef TEST_H_WITH_MPI
+/**
+ * Collect the results of all ranks on rank 0 now instead of in MPI_Finalize().
+ * Must be called by all ranks.
+ */
+TEST_H_API void collectMpi();
+#endif
+
+/**
+ * Run all tests that were registered with TEST_H_AUTORUN set to 0.
+ * Returns 0 if all checks passed and 1 otherwise, so the result can be
+ * returned from main.
+ */
+TEST_H_API int runAll();
+
+/**
+ * Run the registered tests with the command line options of main():
+ *   --filter=PATTERNS   run only matching tests, e.g. "Vector*:-*Slow"
+ *   --shard=I/N         run only shard I of N, e.g. on one of N CI machines
+ *   --timings=FILE      balance the shards with the durations in FILE
+ *   --record-timings=FILE  write the durations of this run to FILE
+ *   --processes=N       run the tests in N worker processes
+ *   --update-golden     write the golden files of check_golden()
+ *   --baseline=FILE     compare the benchmarks with the baselines in FILE
+ *   --update-baseline   write the results of the benchmarks to that FILE
+ *   --list              print the names of the selected tests instead
+ * The environment variables TEST_H_FILTER, TEST_H_SHARD, TEST_H_TIMINGS,
+ * TEST_H_RECORD_TIMINGS, TEST_H_PROCESSES, TEST_H_UPDATE_GOLDEN,
+ * TEST_H_BASELINE and TEST_H_UPDATE_BASELINE set the same options. Other arguments are ignored.
+ * Returns 0 if all checks passed and 1 otherwise, 2 for invalid options.
+ */
+TEST_H_API int runAll(int argc, char** argv);
+
+/**
+ * Run only the tests whose names match the filter, a list of glob patterns
+ * separated by ':'. Patterns starting with '-' exclude tests.
+ */
+TEST_H_API void setFilter(std::string_view filter);
+
+/**
+ * Run only shard index (counting from 0) of count shards of the tests.
+ * Returns false if index is not below count.
+ */
+TEST_H_API bool setShard(unsigned index, unsigned count);
+
+/**
+ * Run the registered tests in the given number of worker processes, forked by
+ * Test::runAll(). A test that crashes or exits then only fails itself, and
+ * the other tests and the summary are not lost. 0 (the default, or the value
+ * of the environment variable TEST_H_PROCESSES) runs the tests in this
+ * process. Each worker runs one test at a time, Test::setThreads() does not
+ * apply. Only available on POSIX systems, elsewhere the tests run in this
+ * process.
+ */
+TEST_H_API void setProcesses(unsigned processes);
+
+/**
+ * Set the number of threads Test::runAll() distributes the tests to.
+ * The default is 1 or the value of the environment variable TEST_H_THREADS,
+ * 0 uses one thread per core. Tests run in parallel must not depend on each
+ * other; their output is still printed in the order of registration.
+ */
+TEST_H_API void setThreads(unsigned threads);
+
+/**
+ * Measure the wall time of every registered test and print the given number
+ * of slowest tests in the summary. 0 (the default) disables timing, the
+ * environment variable TEST_H_TIMING sets the number as well.
+ */
+TEST_H_API void setTiming(std::size_t slowestTests = 10);
+
+/**
+ * Format the results with the given reporter instead of the human readable
+ * text, nullptr restores the text. The reporter has to live until the end of
+ * the program. Install it before the first check.
+ */
+TEST_H_API void setReporter(Reporter* reporter);
+
+/**
+ * Install one of the built-in reporters by name: "junit", "tap", "jsonl" or
+ * "text". This is also done by the environment variable TEST_H_REPORTER.
+ * Returns false for unknown names.
+ */
+TEST_H_API bool setReporter(std::string_view name);
+
+/**
+ * Write all output to the given file, like the environment variable
+ * TEST_H_OUTPUT. Returns false if the file could not be opened.
+ */
+TEST_H_API bool setOutput(const char* path);
+
+/**
+ * Print only the first maxFailures failing checks, count the later ones and
+ * skip the remaining tests of Test::runAll(). 0 (the default) means no limit,
+ * the environment variable TEST_H_MAX_FAILURES sets the limit as well.
+ */
+TEST_H_API void setMaxFailures(std::uint64_t maxFailures);
+
+/**
+ * Number of random cases tried by each PROPERTY, 100 by default or the value
+ * of the environment variable TEST_H_PROPERTY_CASES
+ */
+inline void setPropertyCases(std::size_t cases) {
+  Detail::PropertyOptions::instance().cases = cases > 0 ? cases : 1;
+}
+
+/**
+ * Number of threads trying the cases of a PROPERTY, 0 (the default) uses one
+ * thread per core, also set by TEST_H_PROPERTY_THREADS. The code of a
+ * property must not share state between cases if it runs on several threads.
+ */
+inline void setPropertyThreads(unsigned threads) {
+  Detail::PropertyOptions::instance().threads = threads;
+}
+
+/**
+ * Seed of the random arguments of PROPERTY, 0 by default or the value of
+ * TEST_H_SEED. The same seed reproduces the same cases.
+ */
+inline void setSeed(std::uint64_t seed) {
+  Detail::PropertyOptions::instance().seed = seed;
+}
+
+/**
+ * Directory of the golden files of check_golden(), "golden" by default or the
+ * value of the environment variable TEST_H_GOLDEN_DIR
+ */
+TEST_H_API void setGoldenDirectory(std::string_view directory);
+
+/**
+ * Write the golden files of check_golden() instead of comparing with them
+ */
+TEST_H_API void setUpdateGolden(bool update);
+
+/**
+ * File with the baselines of the benchmarks, also set with TEST_H_BASELINE.
+ * Each benchmark with a baseline for this machine becomes a check that fails
+ * if it is significantly slower than allowed by setRegressionThreshold().
+ */
+TEST_H_API void setBaselineFile(std::string_view path);
+
+/**
+ * Write the samples of the benchmarks to the baseline file instead of
+ * comparing with it, also set with TEST_H_UPDATE_BASELINE=1
+ */
+TEST_H_API void setUpdateBaseline(bool update);
+
+/**
+ * Allowed slowdown of a benchmark as a fraction of its baseline, 0.1 by
+ * default or the value of TEST_H_REGRESSION_THRESHOLD
+ */
+TEST_H_API void setRegressionThreshold(double threshold);
+
+/**
+ * Name under which the baselines of this machine are stored, the host name
+ * by default or the value of TEST_H_MACHINE
+ */
+TEST_H_API void setMachine(std::string_view machine);
+
+/**
+ * Count cycles, instructions, cache misses and branch misses of every TEST
+ * and BENCHMARK with Test::PerfCounters, also enabled with
+ * TEST_H_PERF_COUNTERS=1. The counts are listed in the summary and passed to
+ * the reporters. Only the thread running a test is counted.
+ */
+TEST_H_API void setPerfCounters(bool perfCounters);
+
+/**
+ * Allocations of the calling thread so far
+ */
+inline Allocations allocations() { return Detail::threadAllocations; }
+
+}  // namespace Test
+
+#ifdef TEST_H_WITH_IMPLEMENTATION
+
+namespace Test {
+
+TEST_H_API StreamSink::StreamSink() : stream_(std::cout) {}
+
+TEST_H_API void StreamSink::write(const char* data, std::size_t size) {
+  stream_.write(data, static_cast<std::streamsize>(size));
+}
+
+TEST_H_API void StreamSink::flush() { stream_.flush(); }
+
+}  // namespace Test
+
+namespace Test::Detail {
+
+TEST_H_API void appendStreamed(std::string& out,
+                               void (*write)(std::ostream&, const void*),
+                               const void* object) {
+  std::ostringstream stream;
+  stream << std::setprecision(10);
+  write(stream, object);
+  out += stream.str();
+}
+
+/**
+ * SIMD implementations of the absolute and relative bounds of isClose().
+ * mismatches() returns a bit mask of the lanes that are not within these
+ * bounds. Which one is used depends on the instruction set the code is
+ * compiled for (e.g. -mavx2 or -march=native), there is no dispatch at
+ * runtime. Types without kernel have zero lanes.
+ */
+template <typename T>
+struct SimdKernel {
+  static constexpr std::size_t lanes = 0;
+};
+
+#if defined(__AVX512F__)
+template <>
+struct SimdKernel<double> {
+  static constexpr std::size_t lanes = 8;
+
+  explicit SimdKernel(const Tolerance& tolerance)
+      : absolute(_mm512_set1_pd(tolerance.absoluteEpsilon)),
+        relative(_mm512_set1_pd(tolerance.relativeEpsilon)) {}
+
+  unsigned mismatches(const double* expected, const double* actual) const {
+    const __m512d e = _mm512_loadu_pd(expected);
+    const __m512d a = _mm512_loadu_pd(actual);
+    const __m512d magnitudeA = _mm512_abs_pd(a);
+    const __m512d magnitudeE = _mm512_abs_pd(e);
+    const __m512d distance = _mm512_abs_pd(_mm512_sub_pd(a, e));
+    const __m512d infinity =
+        _mm512_set1_pd(std::numeric_limits<double>::infinity());
+    // the bounds only apply if both values are finite
+    const __mmask8 finite =
+        _mm512_cmp_pd_mask(magnitudeA, infinity, _CMP_LT_OQ) &
+        _mm512_cmp_pd_mask(magnitudeE, infinity, _CMP_LT_OQ);
+    // comparing with both magnitudes instead of their maximum
+    const __mmask8 close =
+        _mm512_cmp_pd_mask(a, e, _CMP_EQ_OQ) |
+        (finite &
+         (_mm512_cmp_pd_mask(distance, absolute, _CMP_LT_OQ) |
+          _mm512_cmp_pd_mask(distance, _mm512_mul_pd(relative, magnitudeA),
+                             _CMP_LE_OQ) |
+          _mm512_cmp_pd_mask(distance, _mm512_mul_pd(relative, magnitudeE),
+                             _CMP_LE_OQ)));
+    return ~static_cast<unsigned>(close) & 0xffu;
+  }
+
+  __m512d absolute;
+  __m512d relative;
+};
+
+template <>
+struct SimdKernel<float> {
+  static constexpr std::size_t lanes = 16;
+
+  explicit SimdKernel(const Tolerance& tolerance)
+      : absolute(_mm512_set1_ps(static_cast<float>(tolerance.absoluteEpsilon))),
+        relative(
+            _mm512_set1_ps(static_cast<float>(tolerance.relativeEpsilon))) {}
+
+  unsigned mismatches(const float* expected, const float* actual) const {
+    const __m512 e = _mm512_loadu_ps(expected);
+    const __m512 a = _mm512_loadu_ps(actual);
+    const __m512 magnitudeA = _mm512_abs_ps(a);
+    const __m512 magnitudeE = _mm512_abs_ps(e);
+    const __m512 distance = _mm512_abs_ps(_mm512_sub_ps(a, e));
+    const __m512 infinity =
+        _mm512_set1_ps(std::numeric_limits<float>::infinity());
+    // the bounds only apply if both values are finite
+    const __mmask16 finite =
+        _mm512_cmp_ps_mask(magnitudeA, infinity, _CMP_LT_OQ) &
+        _mm512_cmp_ps_mask(magnitudeE, infinity, _CMP_LT_OQ);
+    // comparing with both magnitudes instead of their maximum
+    const __mmask16 close =
+        _mm512_cmp_ps_mask(a, e, _CMP_EQ_OQ) |
+        (finite &
+         (_mm512_cmp_ps_mask(distance, absolute, _CMP_LT_OQ) |
+          _mm512_cmp_ps_mask(distance, _mm512_mul_ps(relative, magnitudeA),
+                             _CMP_LE_OQ) |
+          _mm512_cmp_ps_mask(distance, _mm512_mul_ps(relative, magnitudeE),
+                             _CMP_LE_OQ)));
+    return ~static_cast<unsigned>(close) & 0xffffu;
+  }
+
+  __m512 absolute;
+  __m512 relative;
+};
+#elif defined(__AVX2__)
+template <>
+struct SimdKernel<double> {
+  static constexpr std::size_t lanes = 4;
+
+  explicit SimdKernel(const Tolerance& tolerance)
+      : absolute(_mm256_set1_pd(tolerance.absoluteEpsilon)),
+        relative(_mm256_set1_pd(tolerance.relativeEpsilon)) {}
+
+  unsigned mismatches(const double* expected, const double* actual) const {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d e = _mm256_loadu_pd(expected);
+    const __m256d a = _mm256_loadu_pd(actual);
+    const __m256d distance = _mm256_andnot_pd(sign, _mm256_sub_pd(a, e));
+    const __m256d scale =
+        _mm256_max_pd(_mm256_andnot_pd(sign, a), _mm256_andnot_pd(sign, e));
+    // the bounds only apply if both values are finite. The maximum of the
+    // magnitudes is infinite otherwise, a NaN fails the comparisons anyway.
+    const __m256d finite = _mm256_cmp_pd(
+        scale, _mm256_set1_pd(std::numeric_limits<double>::infinity()),
+        _CMP_LT_OQ);
+    const __m256d close = _mm256_or_pd(
+        _mm256_cmp_pd(a, e, _CMP_EQ_OQ),
+        _mm256_and_pd(
+            finite,
+            _mm256_or_pd(_mm256_cmp_pd(distance, absolute, _CMP_LT_OQ),
+                         _mm256_cmp_pd(distance, _mm256_mul_pd(relative, scale),
+                                       _CMP_LE_OQ))));
+    return ~static_cast<unsigned>(_mm256_movemask_pd(close)) & 0xfu;
+  }
+
+  __m256d absolute;
+  __m256d relative;
+};
+
+template <>
+struct SimdKernel<float> {
+  static constexpr std::size_t lanes = 8;
+
+  explicit SimdKernel(const Tolerance& tolerance)
+      : absolute(_mm256_set1_ps(static_cast<float>(tolerance.absoluteEpsilon))),
+        relative(
+            _mm256_set1_ps(static_cast<float>(tolerance.relativeEpsilon))) {}
+
+  unsigned mismatches(const float* expected, const float* actual) const {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 e = _mm256_loadu_ps(expected);
+    const __m256 a = _mm256_loadu_ps(actual);
+    const __m256 distance = _mm256_andnot_ps(sign, _mm256_sub_ps(a, e));
+    const __m256 scale =
+        _mm256_max_ps(_mm256_andnot_ps(sign, a), _mm256_andnot_ps(sign, e));
+    const __m256 finite = _mm256_cmp_ps(
+        scale, _mm256_set1_ps(std::numeric_limits<float>::infinity()),
+        _CMP_LT_OQ);
+    const __m256 close = _mm256_or_ps(
+        _mm256_cmp_ps(a, e, _CMP_EQ_OQ),
+        _mm256_and_ps(
+            finite,
+            _mm256_or_ps(_mm256_cmp_ps(distance, absolute, _CMP_LT_OQ),
+                         _mm256_cmp_ps(distance, _mm256_mul_ps(relative, scale),
+                                       _CMP_LE_OQ))));
+    return ~static_cast<unsigned>(_mm256_movemask_ps(close)) & 0xffu;
+  }
+
+  __m256 absolute;
+  __m256 relative;
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+template <>
+struct SimdKernel<double> {
+  static constexpr std::size_t lanes = 2;
+
+  explicit SimdKernel(const Tolerance& tolerance)
+      : absolute(vdupq_n_f64(tolerance.absoluteEpsilon)),
+        relative(vdupq_n_f64(tolerance.relativeEpsilon)) {}
+
+  unsigned mismatches(const double* expected, const double* actual) const {
+    const float64x2_t e = vld1q_f64(expected);
+    const float64x2_t a = vld1q_f64(actual);
+    const float64x2_t distance = vabdq_f64(a, e);
+    const float64x2_t scale = vmaxq_f64(vabsq_f64(a), vabsq_f64(e));
+    // the bounds only apply if both values are finite, the maximum is NaN or
+    // infinite otherwise
+    const uint64x2_t finite = vcltq_f64(
+        scale, vdupq_n_f64(std::numeric_limits<double>::infinity()));
+    const uint64x2_t close = vorrq_u64(
+        vceqq_f64(a, e),
+        vandq_u64(finite,
+                  vorrq_u64(vcltq_f64(distance, absolute),
+                            vcleq_f64(distance, vmulq_f64(relative, scale)))));
+    return static_cast<unsigned>((~vgetq_lane_u64(close, 0) & 1u) |
+                                 ((~vgetq_lane_u64(close, 1) & 1u) << 1));
+  }
+
+  float64x2_t absolute;
+  float64x2_t relative;
+};
+
+template <>
+struct SimdKernel<float> {
+  static constexpr std::size_t lanes = 4;
+
+  explicit SimdKernel(const Tolerance& tolerance)
+      : absolute(vdupq_n_f32(static_cast<float>(tolerance.absoluteEpsilon))),
+        relative(vdupq_n_f32(static_cast<float>(tolerance.relativeEpsilon))) {}
+
+  unsigned mismatches(const float* expected, const float* actual) const {
+    const float32x4_t e = vld1q_f32(expected);
+    const float32x4_t a = vld1q_f32(actual);
+    const float32x4_t distance = vabdq_f32(a, e);
+    const float32x4_t scale = vmaxq_f32(vabsq_f32(a), vabsq_f32(e));
+    const uint32x4_t finite = vcltq_f32(
+        scale, vdupq_n_f32(std::numeric_limits<float>::infinity()));
+    const uint32x4_t far = vmvnq_u32(vorrq_u32(
+        vceqq_f32(a, e),
+        vandq_u32(finite,
+                  vorrq_u32(vcltq_f32(distance, absolute),
+                            vcleq_f32(distance, vmulq_f32(relative, scale))))));
+    return (vgetq_lane_u32(far, 0) & 1u) | ((vgetq_lane_u32(far, 1) & 1u) << 1) |
+           ((vgetq_lane_u32(far, 2) & 1u) << 2) |
+           ((vgetq_lane_u32(far, 3) & 1u) << 3);
+  }
+
+  float32x4_t absolute;
+  float32x4_t relative;
+};
+#endif
+
+/**
+ * countMismatches() with the SIMD kernel if there is one
+ */
+template <typename T>
+std::size_t countMismatchesSimd(const T* expected, const T* actual,
+                                std::size_t size, const Tolerance& tolerance) {
+  std::size_t count = 0;
+  std::size_t i = 0;
+  if constexpr (SimdKernel<T>::lanes > 0) {
+    constexpr std::size_t lanes = SimdKernel<T>::lanes;
+    const SimdKernel<T> kernel(tolerance);
+    for (; i + lanes <= size; i += lanes) {
+      unsigned mask = kernel.mismatches(expected + i, actual + i);
+      // lanes outside the bounds of the kernel may still be within the
+      // allowed ULP distance
+      for (std::size_t lane = 0; mask != 0; ++lane, mask >>= 1) {
+        if ((mask & 1u) != 0)
+          count += !isClose(expected[i + lane], actual[i + lane], tolerance);
+      }
+    }
+  }
+  for (; i < size; ++i)
+    count += !isEqualElement(expected[i], actual[i], tolerance);
+  return count;
+}
+
+TEST_H_API std::size_t countMismatches(const float* expected,
+                                       const float* actual, std::size_t size,
+                                       const Tolerance& tolerance) {
+  return countMismatchesSimd(expected, actual, size, tolerance);
+}
+
+TEST_H_API std::size_t countMismatches(const double* expected,
+                                       const double* actual, std::size_t size,
+                                       const Tolerance& tolerance) {
+  return countMismatchesSimd(expected, actual, size, tolerance);
+}
+
+/**
+ * Duration of a finished test, kept for the table of the slowest tests
+ */
+struct TestTiming {
+  TestCase testCase;
+  std::uint64_t checks;
+  double seconds;
+};
+
+/**
+ * Append a string as a JSON string literal, which is also valid in YAML
+ */
+inline void appendJson(std::string& out, std::string_view text) {
+  static constexpr char hexDigits[] = "0123456789abcdef";
+  out += '"';
+  std::size_t runBegin = 0;
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(text[i]);
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    out.append(text.data() + runBegin, i - runBegin);
+    runBegin = i + 1;
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      default:
+        out += "\\u00";
+        out += hexDigits[c >> 4];
+        out += hexDigits[c & 0xf];
+    }
+  }
+  out.append(text.data() + runBegin, text.size() - runBegin);
+  out += '"';
+}
+
+/**
+ * Append a string to XML text or an attribute value. Control characters are
+ * not allowed in XML 1.0 and replaced by '?'.
+ */
+inline void appendXml(std::string& out, std::string_view text) {
+  std::size_t runBegin = 0;
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(text[i]);
+    const bool control = c < 0x20 && c != '\n' && c != '\t' && c != '\r';
+    if (!control && c != '&' && c != '<' && c != '>' && c != '"' && c != '\'')
+      continue;
+    out.append(text.data() + runBegin, i - runBegin);
+    runBegin = i + 1;
+    switch (c) {
+      case '&':
+        out += "&amp;";
+        break;
+      case '<':
+        out += "&lt;";
+        break;
+      case '>':
+        out += "&gt;";
+        break;
+      case '"':
+        out += "&quot;";
+        break;
+      case '\'':
+        out += "&apos;";
+        break;
+      default:
+        out += '?';
+    }
+  }
+  out.append(text.data() + runBegin, text.size() - runBegin);
+}
+
+/**
+ * Append the description of a failed check in the words of the text report
+ */
+inline void appendFailure(std::string& out, const CheckEvent& check) {
+  if (check.location.file != nullptr) {
+    out += check.location.file;
+    out += ':';
+    appendNumber(out, check.location.line);
+    out += ": ";
+  }
+  if (!check.message.empty()) {
+    out += check.message;
+    return;
+  }
+  out += "expected value \"";
+  out += check.expected;
+  out += "\", but actual value was \"";
+  out += check.actual;
+  out += '"';
+}
+
+/**
+ * Text that a reporter collects for the test running on this thread until
+ * the test has finished
+ */
+inline std::string& pendingReport() {
+  static thread_local std::string text;
+  return text;
+}
+
+}  // namespace Test::Detail
+
+namespace Test {
+
+/**
+ * JUnit XML as understood by most CI servers. A testcase element is written
+ * when its test has finished, failures outside of tests get a testcase of
+ * their own. Only the failures of the running test are kept until then.
+ */
+class JUnitReporter : public Reporter {
+ public:
+  void begin(std::string& out) override {
+    out += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n"
+           "<testsuite name=\"test.h\">\n";
+  }
+
+  void testStarted(std::string&, const TestCase&) override {
+    Detail::pendingReport().clear();
+  }
+
+  void checked(std::string& out, const CheckEvent& check) override {
+    if (check.passed)
+      return;
+    if (check.test == nullptr) {
+      out += "  <testcase name=\"check outside of a test\">\n";
+      appendFailure(out, check);
+      out += "  </testcase>\n";
+    } else {
+      appendFailure(Detail::pendingReport(), check);
+    }
+  }
+
+  void testFinished(std::string& out, const TestEvent& test) override {
+    out += "  <testcase name=\"";
+    Detail::appendXml(out, test.test->name);
+    out += "\" classname=\"";
+    Detail::appendXml(out, test.test->file);
+    out += "\" file=\"";
+    Detail::appendXml(out, test.test->file);
+    out += "\" line=\"";
+    Detail::appendNumber(out, test.test->line);
+    out += "\" assertions=\"";
+    Detail::appendNumber(out, test.checks);
+    out += "\" time=\"";
+    Detail::appendNumber(out, test.seconds);
+    out += "\"";
+    std::string& failures = Detail::pendingReport();
+    if (failures.empty() && test.counters == nullptr) {
+      out += "/>\n";
+      return;
+    }
+    out += ">\n";
+    if (const PerfCounts* counters = test.counters) {
+      out += "    <properties>\n";
+      appendProperty(out, "cycles", counters->cycles);
+      appendProperty(out, "instructions", counters->instructions);
+      appendProperty(out, "cache_misses", counters->cacheMisses);
+      appendProperty(out, "branch_misses", counters->branchMisses);
+      out += "    </properties>\n";
+    }
+    out += failures;
+    out += "  </testcase>\n";
+    failures.clear();
+  }
+
+  void message(std::string& out, std::string_view text) override {
+    out += "  <system-out>";
+    Detail::appendXml(out, text);
+    out += "</system-out>\n";
+  }
+
+  void end(std::string& out, const Summary& summary) override {
+    out += "  <!-- executed checks: ";
+    Detail::appendNumber(out, summary.executed);
+    out += ", failed checks: ";
+    Detail::appendNumber(out, summary.failed);
+    out += " -->\n</testsuite>\n</testsuites>\n";
+  }
+
+ private:
+  static void appendProperty(std::string& out, const char* name,
+                             std::uint64_t value) {
+    out += "      <property name=\"";
+    out += name;
+    out += "\" value=\"";
+    Detail::appendNumber(out, value);
+    out += "\"/>\n";
+  }
+
+  static void appendFailure(std::string& out, const CheckEvent& check) {
+    std::string message;
+    Detail::appendFailure(message, check);
+    out += "    <failure type=\"check\" message=\"";
+    Detail::appendXml(out, message);
+    out += "\">";
+    Detail::appendXml(out, message);
+    out += "</failure>\n";
+  }
+};
+
+/**
+ * Test Anything Protocol version 13 with one test point per test. The
+ * failures of a test are listed in its YAML block, failures outside of tests
+ * are test points of their own. The plan follows at the end.
+ */
+class TapReporter : public Reporter {
+ public:
+  void begin(std::string& out) override { out += "TAP version 13\n"; }
+
+  void testStarted(std::string&, const TestCase&) override {
+    Detail::pendingReport().clear();
+  }
+
+  void checked(std::string& out, const CheckEvent& check) override {
+    if (check.passed)
+      return;
+    if (check.test == nullptr) {
+      points_.fetch_add(1, std::memory_order_relaxed);
+      out += "not ok - check outside of a test\n  ---\n  failures:\n";
+      appendFailure(out, check);
+      out += "  ...\n";
+    } else {
+      appendFailure(Detail::pendingReport(), check);
+    }
+  }
+
+  void testFinished(std::string& out, const TestEvent& test) override {
+    points_.fetch_add(1, std::memory_order_relaxed);
+    out += test.failures == 0 ? "ok - " : "not ok - ";
+    out += test.test->name;
+    out += "\n  ---\n  file: ";
+    Detail::appendJson(out, test.test->file);
+    out += "\n  line: ";
+    Detail::appendNumber(out, test.test->line);
+    out += "\n  checks: ";
+    Detail::appendNumber(out, test.checks);
+    out += "\n  seconds: ";
+    Detail::appendNumber(out, test.seconds);
+    out += "\n";
+    if (const PerfCounts* counters = test.counters) {
+      out += "  cycles: ";
+      Detail::appendNumber(out, counters->cycles);
+      out += "\n  instructions: ";
+      Detail::appendNumber(out, counters->instructions);
+      out += "\n  cache_misses: ";
+      Detail::appendNumber(out, counters->cacheMisses);
+      out += "\n  branch_misses: ";
+      Detail::appendNumber(out, counters->branchMisses);
+      out += "\n";
+    }
+    std::string& failures = Detail::pendingReport();
+    if (!failures.empty()) {
+      out += "  failures:\n";
+      out += failures;
+      failures.clear();
+    }
+    out += "  ...\n";
+  }
+
+  void forwarded(std::string_view output) override {
+    // count the test points of the worker for the plan
+    std::uint64_t points = 0;
+    while (!output.empty()) {
+      const std::size_t end = std::min(output.find('\n'), output.size() - 1);
+      const std::string_view line = output.substr(0, end);
+      points += line.substr(0, 3) == "ok " || line.substr(0, 7) == "not ok ";
+      output.remove_prefix(end + 1);
+    }
+    points_.fetch_add(points, std::memory_order_relaxed);
+  }
+
+  void message(std::string& out, std::string_view text) override {
+    while (!text.empty()) {
+      const std::size_t end = std::min(text.find('\n'), text.size());
+      out += "# ";
+      out += text.substr(0, end);
+      out += '\n';
+      text.remove_prefix(std::min(end + 1, text.size()));
+    }
+  }
+
+  void end(std::string& out, const Summary& summary) override {
+    out += "1..";
+    Detail::appendNumber(out, points_.load());
+    out += "\n# executed checks: ";
+    Detail::appendNumber(out, summary.executed);
+    out += ", failed checks: ";
+    Detail::appendNumber(out, summary.failed);
+    out += "\n";
+  }
+
+ private:
+  static void appendFailure(std::string& out, const CheckEvent& check) {
+    std::string message;
+    Detail::appendFailure(message, check);
+    out += "    - message: ";
+    Detail::appendJson(out, message);
+    if (check.message.empty()) {
+      out += "\n      expected: ";
+      Detail::appendJson(out, check.expected);
+      out += "\n      actual: ";
+      Detail::appendJson(out, check.actual);
+    }
+    out += "\n";
+  }
+
+  std::atomic<std::uint64_t> points_ = 0;
+};
+
+/**
+ * One JSON object per line and event: test_started, check, test_finished,
+ * message and summary
+ */
+class JsonLinesReporter : public Reporter {
+ public:
+  void testStarted(std::string& out, const TestCase& test) override {
+    out += "{\"event\":\"test_started\"";
+    appendTest(out, &test);
+    out += "}\n";
+  }
+
+  void checked(std::string& out, const CheckEvent& check) override {
+    out += "{\"event\":\"check\",\"passed\":";
+    out += check.passed ? "true" : "false";
+    appendTest(out, check.test);
+    if (check.location.file != nullptr) {
+      out += ",\"check_file\":";
+      Detail::appendJson(out, check.location.file);
+      out += ",\"check_line\":";
+      Detail::appendNumber(out, check.location.line);
+    }
+    if (check.message.empty()) {
+      out += ",\"expected\":";
+      Detail::appendJson(out, check.expected);
+      out += ",\"actual\":";
+      Detail::appendJson(out, check.actual);
+    } else {
+      out += ",\"message\":";
+      Detail::appendJson(out, check.message);
+    }
+    out += "}\n";
+  }
+
+  void testFinished(std::string& out, const TestEvent& test) override {
+    out += "{\"event\":\"test_finished\"";
+    appendTest(out, test.test);
+    out += ",\"checks\":";
+    Detail::appendNumber(out, test.checks);
+    out += ",\"failures\":";
+    Detail::appendNumber(out, test.failures);
+    out += ",\"seconds\":";
+    Detail::appendNumber(out, test.seconds);
+    if (const PerfCounts* counters = test.counters) {
+      out += ",\"cycles\":";
+      Detail::appendNumber(out, counters->cycles);
+      out += ",\"instructions\":";
+      Detail::appendNumber(out, counters->instructions);
+      out += ",\"cache_misses\":";
+      Detail::appendNumber(out, counters->cacheMisses);
+      out += ",\"branch_misses\":";
+      Detail::appendNumber(out, counters->branchMisses);
+    }
+    out += "}\n";
+  }
+
+  void message(std::string& out, std::string_view text) override {
+    out += "{\"event\":\"message\",\"text\":";
+    Detail::appendJson(out, text);
+    out += "}\n";
+  }
+
+  void end(std::string& out, const Summary& summary) override {
+    out += "{\"event\":\"summary\",\"executed\":";
+    Detail::appendNumber(out, summary.executed);
+    out += ",\"failed\":";
+    Detail::appendNumber(out, summary.failed);
+    out += "}\n";
+  }
+
+ private:
+  static void appendTest(std::string& out, const TestCase* test) {
+    if (test == nullptr) {
+      out += ",\"test\":null";
+      return;
+    }
+    out += ",\"test\":";
+    Detail::appendJson(out, test->name);
+    out += ",\"file\":";
+    Detail::appendJson(out, test->file);
+    out += ",\"line\":";
+    Detail::appendNumber(out, test->line);
+  }
+};
+
+}  // namespace Test
+
+namespace Test::Detail {
+
+/**
+ * Output handed to the writer thread of the asynchronous mode. A check of
+ * numbers or enums keeps copies of its operands and is only formatted by the
+ * writer, all other output arrives as text.
+ */
+struct AsyncRecord {
+  bool check = false;
+  bool passed = false;
+  // flush the sink once the record is written
+  bool flush = false;
+  const TestCase* test = nullptr;
+  SourceLocation location;
+  Value::AppendFunction appendExpected = nullptr;
+  Value::AppendFunction appendActual = nullptr;
+  alignas(16) unsigned char expected[16];
+  alignas(16) unsigned char actual[16];
+  std::string text;
+};
+
+/**
+ * Bounded lock-free queue with many producers and the writer thread as its
+ * only consumer (D. Vyukov's bounded queue). The sequence number of a cell
+ * tells whether it is free for the producer of a position or holds a record
+ * for the consumer. The cells are reused, so text records only allocate
+ * while their strings grow. Producers wait while the queue is full.
+ */
+class RecordQueue {
+ public:
+  static constexpr std::size_t capacity = 4096;
+
+  RecordQueue() {
+    for (std::size_t i = 0; i < capacity; ++i)
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  /**
+   * Claim the next position, let fill write the record and publish it
+   */
+  template <typename Fill>
+  void push(const Fill& fill) {
+    std::uint64_t position = enqueue_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[position % capacity];
+      const std::uint64_t sequence =
+          cell.sequence.load(std::memory_order_acquire);
+      if (sequence == position) {
+        if (enqueue_.compare_exchange_weak(position, position + 1,
+                                           std::memory_order_relaxed)) {
+          fill(cell.record);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return;
+        }
+      } else {
+        // the cell of the previous round is not consumed yet, or another
+        // producer has claimed the position
+        if (sequence < position)
+          std::this_thread::yield();
+        position = enqueue_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * Pass the oldest record to consume, returns false if there is none. Only
+   * called by the writer thread.
+   */
+  template <typename Consume>
+  bool pop(const Consume& consume) {
+    Cell& cell = cells_[dequeue_ % capacity];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeue_ + 1)
+      return false;
+    consume(cell.record);
+    cell.sequence.store(dequeue_ + capacity, std::memory_order_release);
+    ++dequeue_;
+    return true;
+  }
+
+  /**
+   * Number of records pushed or being pushed so far
+   */
+  std::uint64_t pushed() const {
+    return enqueue_.load(std::memory_order_acquire);
+  }
+
+ private:
+  struct alignas(TEST_H_CACHE_LINE) Cell {
+    std::atomic<std::uint64_t> sequence;
+    AsyncRecord record;
+  };
+
+  std::unique_ptr<Cell[]> cells_ = std::make_unique<Cell[]>(capacity);
+  alignas(TEST_H_CACHE_LINE) std::atomic<std::uint64_t> enqueue_ = 0;
+  alignas(TEST_H_CACHE_LINE) std::uint64_t dequeue_ = 0;
+};
+
+/**
+ * This class realizes some basics of the test framework.
+ * Test summary is printed in the destructor.
+ * Apart from that, the class implements counting of total and failed tests,
+ * comparison of floating point numbers within sensible boundaries and prints
+ * the result of each test on the command line.
+ *
+ * Output is collected in a buffer per thread and handed to the sink in large
+ * chunks, so the order of the output is kept within each thread. The buffers
+ * are flushed when they are full, when their thread exits, when the program
+ * ends and, if enabled, after every failing check.
+ * A check only touches the buffer of its own thread. The only lock is taken
+ * when a whole chunk is handed to the sink, so the sink never sees
+ * interleaved reports and does not need to be thread-safe itself.
+ *
+ * In the asynchronous mode all chunks go through a RecordQueue to a writer
+ * thread instead. Checks of numbers and enums skip the buffer and only push
+ * their operands, the writer formats them.
+ */
+class Test {
+ public:
+  /**
+   * Test class is a Singleton
+   */
+  static Test& instance() {
+    static Test test;
+    return test;
+  }
+
+  /**
+   * the main entry point for tests. Count the comparison of two values and
+   * output the result.
+   */
+  bool check(bool testResult, const Value& expectedValue,
+             const Value& actualValue,
+             const SourceLocation& location = SourceLocation()) {
+    ThreadState& state = threadState();
+    if (registerTest(state, testResult)) {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      report(state, testResult, expectedValue, actualValue, location);
+    }
+
+    return testResult;
+  }
+
+  /**
+   * Compare two strings without copying them. A failure shows both strings
+   * from shortly before the first difference if they are too long to be
+   * printed completely.
+   */
+  bool checkString(std::string_view expectedValue,
+                   std::string_view actualValue,
+                   const SourceLocation& location = SourceLocation()) {
+    const bool testResult = expectedValue == actualValue;
+    ThreadState& state = threadState();
+    if (!registerTest(state, testResult))
+      return testResult;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (testResult) {
+      report(state, testResult, Value(expectedValue), Value(actualValue),
+             location);
+      return testResult;
+    }
+
+    const std::size_t size = std::min(expectedValue.size(), actualValue.size());
+    const std::size_t position =
+        std::mismatch(expectedValue.begin(), expectedValue.begin() + size,
+                      actualValue.begin())
+            .first -
+        expectedValue.begin();
+    std::string& out = output(state);
+    if (Reporter* reporter = activeReporter()) {
+      // the same excerpts as in the text, the reporter escapes them
+      state.expected.clear();
+      appendPlainString(state.expected, expectedValue, position);
+      state.actual.clear();
+      appendPlainString(state.actual, actualValue, position);
+      reporter->checked(out,
+                        CheckEvent{testResult, currentTestCase(state),
+                                   state.expected, state.actual, {}, location});
+      finishReport(state, testResult);
+      return testResult;
+    }
+    appendErrorPrefix(out, currentTestCase(state), location);
+    out += "expected value ";
+    appendString(out, expectedValue, position);
+    out += ", but actual value was ";
+    appendString(out, actualValue, position);
+    if (std::max(expectedValue.size(), actualValue.size()) >
+        TEST_H_MAX_STRING_LENGTH) {
+      out += ", first difference at index ";
+      appendNumber(out, position);
+    }
+    out += "\n";
+    finishReport(state, testResult);
+    return testResult;
+  }
+
+  /**
+   * Count a check whose result was computed by the caller. The message is
+   * only written, by appendMessage, if it is printed.
+   */
+  bool checkWithMessage(bool testResult, const MessageFunction& appendMessage,
+                        const SourceLocation& location = SourceLocation()) {
+    ThreadState& state = threadState();
+    if (registerTest(state, testResult)) {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      report(state, testResult, appendMessage, location);
+    }
+
+    return testResult;
+  }
+
+  void setVerbosity(Verbosity verbosity) {
+    verbosity_.store(verbosity, std::memory_order_relaxed);
+  }
+
+  void setFlushOnFailure(bool flushOnFailure) {
+    flushOnFailure_.store(flushOnFailure, std::memory_order_relaxed);
+  }
+
+  /**
+   * Start or stop the writer thread of the asynchronous mode. Must not be
+   * called while other threads run checks.
+   */
+  void setAsync(bool async) {
+    std::lock_guard<std::mutex> lock(asyncMutex_);
+    if (async == async_.load())
+      return;
+    flushAll();
+    if (async) {
+      asyncQueue_ = std::make_unique<RecordQueue>();
+      asyncWritten_.store(0);
+      asyncStop_.store(false);
+      asyncWriter_ = std::thread([this] { runWriter(); });
+      async_.store(true, std::memory_order_release);
+    } else {
+      async_.store(false);
+      asyncStop_.store(true, std::memory_order_release);
+      asyncWriter_.join();
+      asyncQueue_.reset();
+    }
+  }
+
+  /**
+   * Flush all buffers and install a new sink, nullptr restores the default
+   * sink writing to std::cout.
+   */
+  void setSink(Sink* sink) {
+    flushAll();
+    sink_.store(sink != nullptr ? sink : &defaultSink_);
+  }
+
+  /**
+   * Only the first maxFailures failing checks are printed, later ones are
+   * only counted and the runner skips the remaining tests. 0 means no limit.
+   */
+  void setMaxFailures(std::uint64_t maxFailures) {
+    maxFailures_.store(maxFailures, std::memory_order_relaxed);
+  }
+
+  bool failureLimitReached() const {
+    const std::uint64_t maxFailures =
+        maxFailures_.load(std::memory_order_relaxed);
+    return maxFailures != 0 &&
+           failures_.load(std::memory_order_relaxed) >= maxFailures;
+  }
+
+  /**
+   * Called after a require() failed. Aborts the running test, or the program
+   * if the check is not part of a test run by the runner.
+   */
+  [[noreturn]] void requireFailed() {
+    ThreadState& state = threadState();
+    if (state.test != nullptr)
+      throw RequireFailure();
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      appendNote(state, "A required check failed, exiting\n");
+      finishReport(state, false);
+    }
+    std::exit(EXIT_FAILURE);
+  }
+
+  /**
+   * Append free text to the output of the calling thread, through the
+   * reporter if one is installed
+   */
+  void appendNote(std::string_view text) {
+    ThreadState& state = threadState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    appendNote(state, text);
+    finishReport(state, true);
+  }
+
+  /**
+   * Install a reporter, nullptr restores the human readable text. The
+   * reporter is not owned and has to live until the end of the program.
+   */
+  void setReporter(Reporter* reporter) {
+    flushAll();
+    std::lock_guard<std::mutex> lock(reporterMutex_);
+    reporterStarted_.store(false);
+    reporter_.store(reporter);
+  }
+
+  /**
+   * Install one of the reporters "junit", "tap" or "jsonl", or "text" for the
+   * human readable text. Returns false for unknown names.
+   */
+  bool setReporter(std::string_view name) {
+    std::unique_ptr<Reporter> reporter;
+    if (name == "junit")
+      reporter = std::make_unique<JUnitReporter>();
+    else if (name == "tap")
+      reporter = std::make_unique<TapReporter>();
+    else if (name == "jsonl" || name == "json")
+      reporter = std::make_unique<JsonLinesReporter>();
+    else if (name != "text")
+      return false;
+    setReporter(reporter.get());
+    ownedReporter_ = std::move(reporter);
+    return true;
+  }
+
+  /**
+   * Write all output to a file instead of std::cout. Returns false if the
+   * file could not be opened.
+   */
+  bool setOutput(const char* path) {
+    std::unique_ptr<FileSink> sink = std::make_unique<FileSink>(path);
+    if (!sink->isOpen())
+      return false;
+    setSink(sink.get());
+    fileSink_ = std::move(sink);
+    return true;
+  }
+
+  /**
+   * Hand the output of the calling thread to the sink
+   */
+  void flush() {
+    ThreadState& state = threadState();
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      flushBuffer(state);
+    }
+    drainAsync();
+  }
+
+  /**
+   * Write a complete report directly to the sink, bypassing the buffers.
+   * Used for reports at the end of the program, when the buffers of the
+   * threads might already be gone.
+   */
+  void write(const std::string& text, bool flush = true) {
+    writeToSink(text, flush);
+  }
+
+  /**
+   * Write a free text report, e.g. of a benchmark, directly to the sink.
+   * Goes through the reporter if one is installed.
+   */
+  void note(const std::string& text) {
+    Reporter* reporter = activeReporter();
+    if (reporter == nullptr) {
+      writeToSink(text, true);
+      return;
+    }
+    std::string out;
+    reporter->message(out, text);
+    writeToSink(out, true);
+  }
+
+  /**
+   * Whether a reporter is installed, the runner then measures the time of
+   * every test
+   */
+  bool reporting() const { return reporter_.load() != nullptr; }
+
+  /**
+   * Called by the runner on the thread of the test, after the test has been
+   * set as the current test and before it is reset
+   */
+  void testStarted(const TestResult& result) {
+    if (Reporter* reporter = activeReporter()) {
+      ThreadState& state = threadState();
+      std::lock_guard<std::mutex> lock(state.mutex);
+      reporter->testStarted(output(state), *result.testCase);
+      finishReport(state, true);
+    }
+  }
+
+  void testFinished(const TestResult& result) {
+    if (Reporter* reporter = activeReporter()) {
+      ThreadState& state = threadState();
+      std::lock_guard<std::mutex> lock(state.mutex);
+      reporter->testFinished(
+          output(state),
+          TestEvent{result.testCase, result.checks, result.failures,
+                    result.seconds,
+                    result.counters.available ? &result.counters : nullptr});
+      finishReport(state, result.failures == 0);
+    }
+  }
+
+  /**
+   * Called by the runner before it forks a worker process. Hands all buffered
+   * output to the sink, so the worker does not inherit and repeat it, and
+   * starts the reporter, so its beginning is written only once.
+   */
+  void prepareFork() {
+    flushAll();
+    activeReporter();
+    std::lock_guard<std::mutex> lock(sinkMutex_);
+    sink_.load()->flush();
+    std::fflush(nullptr);
+  }
+
+  /**
+   * Called in a worker process right after the fork. The output is kept in
+   * memory and sent to the runner with the result of each test.
+   */
+  void startWorker() {
+    // The writer thread does not exist in the child, prepareFork() has
+    // drained its queue. Its handle is still joinable, so it is replaced
+    // without join(), detach() or the destructor, which would all refer to
+    // the missing thread. The worker then writes synchronously.
+    if (async_.load()) {
+      async_.store(false);
+      asyncStop_.store(false);
+      new (&asyncWriter_) std::thread();
+      asyncQueue_.reset();
+    }
+    sink_.store(&workerOutput_);
+    reporterStarted_.store(true);
+  }
+
+  /**
+   * The output of all threads of a worker process since the last call
+   */
+  std::string takeWorkerOutput() {
+    flushAll();
+    std::lock_guard<std::mutex> lock(sinkMutex_);
+    return workerOutput_.take();
+  }
+
+  /**
+   * Count the checks of a test that ran in a worker process, with their
+   * reports already formatted by the worker
+   */
+  void addForwarded(const TestResult& result, std::uint64_t executed,
+                    std::uint64_t failed) {
+    ThreadState& state = threadState();
+    state.numTests.store(
+        state.numTests.load(std::memory_order_relaxed) + executed,
+        std::memory_order_relaxed);
+    state.numFailedTests.store(
+        state.numFailedTests.load(std::memory_order_relaxed) + failed,
+        std::memory_order_relaxed);
+    failures_.fetch_add(failed, std::memory_order_relaxed);
+    if (timing() && !result.skipped && !result.testCase->benchmark)
+      recordTiming(result);
+    if (perfCounters() && !result.skipped)
+      recordCounters(result);
+    if (Reporter* reporter = activeReporter())
+      reporter->forwarded(result.output);
+  }
+
+  /**
+   * Measure the wall time of the tests and print the given number of slowest
+   * tests in the summary, 0 disables timing
+   */
+  void setTiming(std::size_t slowestTests) {
+    std::lock_guard<std::mutex> lock(timingsMutex_);
+    slowestTests_ = slowestTests;
+    timing_.store(slowestTests > 0, std::memory_order_relaxed);
+  }
+
+  bool timing() const { return timing_.load(std::memory_order_relaxed); }
+
+  /**
+   * Count the hardware events of every test and list them in the summary
+   */
+  void setPerfCounters(bool perfCounters) {
+    perfCounters_.store(perfCounters, std::memory_order_relaxed);
+  }
+
+  bool perfCounters() const {
+    return perfCounters_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Called by the runner after a test with counters enabled has finished
+   */
+  void recordCounters(const TestResult& result) {
+    std::lock_guard<std::mutex> lock(timingsMutex_);
+    ++countedTests_;
+    if (result.counters.available)
+      counters_.emplace_back(*result.testCase, result.counters);
+  }
+
+  /**
+   * Called by the runner after a test with timing enabled has finished
+   */
+  void recordTiming(const TestResult& result) {
+    std::lock_guard<std::mutex> lock(timingsMutex_);
+    timings_.push_back({*result.testCase, result.checks, result.seconds});
+  }
+
+  /**
+   * Attribute the checks of the calling thread to the given test, nullptr
+   * ends the attribution. Returns the previous test.
+   */
+  TestResult* setCurrentTest(TestResult* test) {
+    ThreadState& state = threadState();
+    TestResult* previous = state.test;
+    state.test = test;
+    return previous;
+  }
+
+  TestResult* currentTest() { return threadState().test; }
+
+  /**
+   * Sum up the counters of all threads
+   */
+  Summary summary() {
+    Summary result;
+    threads_.forEach([&result](ThreadState& state) {
+      result.executed += state.numTests.load(std::memory_order_relaxed);
+      result.failed += state.numFailedTests.load(std::memory_order_relaxed);
+    });
+    return result;
+  }
+
+#ifdef TEST_H_WITH_MPI
+  /**
+   * Collect the results of all ranks on rank 0 and print the summary there.
+   * Collective operation, must be called by all ranks before MPI_Finalize().
+   * Happens automatically within MPI_Finalize(), calling it again does nothing.
+   */
+  void collectMpi() {
+    if (!mpiSetUp_.load() || mpiCollected_)
+      return;
+    mpiCollected_ = true;
+    flushAll();
+
+    int rank = 0;
+    int size = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    const Summary local = summary();
+    mpiCollectedCounts_ = local;
+    mpiRank_ = rank;
+    std::uint64_t counts[2] = {local.executed, local.failed};
+    std::uint64_t totals[2] = {0, 0};
+    MPI_Reduce(counts, totals, 2, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // only the failure messages of the other ranks are collected, rank 0 has
+    // printed its own output already
+    const std::string& failures = mpiFailures_.text();
+    int length = static_cast<int>(failures.size());
+    std::vector<int> lengths(rank == 0 ? size : 0);
+    MPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, 0,
+               MPI_COMM_WORLD);
+    std::vector<int> offsets(lengths.size());
+    std::string allFailures;
+    for (std::size_t i = 0; i < lengths.size(); ++i) {
+      offsets[i] = static_cast<int>(allFailures.size());
+      allFailures.resize(allFailures.size() + lengths[i]);
+    }
+    MPI_Gatherv(failures.data(), length, MPI_CHAR, allFailures.data(),
+                lengths.data(), offsets.data(), MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    if (rank == 0 && activeReporter() != nullptr) {
+      // the other ranks have formatted their failures with the reporter
+      activeReporter()->end(allFailures, Summary{totals[0], totals[1]});
+      writeToSink(allFailures, true);
+    } else if (rank == 0) {
+      std::ostringstream report;
+      for (int i = 1; i < size; ++i) {
+        if (lengths[i] == 0)
+          continue;
+        report << "\nFailed checks on rank " << i << ":\n";
+        report.write(allFailures.data() + offsets[i], lengths[i]);
+      }
+      report << "\n--------------------------------------\n";
+      report << "Test summary (" << size << " MPI ranks):\n";
+      report << "Executed tests: " << totals[0] << "\n";
+      report << "Failed tests: " << totals[1] << "\n";
+      reportTimings(report);
+      reportCounters(report);
+      writeToSink(report.str(), true);
+    } else {
+      // output after MPI_Finalize() is printed locally again
+      std::lock_guard<std::mutex> lock(sinkMutex_);
+      sink_.store(mpiPreviousSink_);
+    }
+  }
+#endif
+
+ private:
+  /**
+   * Counters and output of one thread that has not been handed to the sink
+   * yet. The states are owned by the Test instance and reused when their
+   * thread exits, so the destructor can flush threads that are still running,
+   * e.g. the threads of an OpenMP thread pool.
+   * Each state fills whole cache lines, so threads counting their checks do
+   * not invalidate each other's caches.
+   */
+  struct alignas(TEST_H_CACHE_LINE) ThreadState {
+    std::atomic<std::uint64_t> numTests = 0;
+    std::atomic<std::uint64_t> numFailedTests = 0;
+    // held by the owning thread while it writes a report to text, and by
+    // flushAll() while it takes the text of another thread
+    std::mutex mutex;
+    std::string text;
+    TestResult* test = nullptr;
+    // operands and messages of checks are formatted here for the reporter
+    std::string expected;
+    std::string actual;
+    std::string message;
+  };
+
+  /**
+   * Returns the state back to the Test instance when the thread exits
+   */
+  struct ThreadStateHandle {
+    ThreadSlots<ThreadState>::Slot* slot = nullptr;
+    ~ThreadStateHandle() {
+      if (slot != nullptr)
+        Test::instance().releaseThreadState(*slot);
+    }
+  };
+
+  /**
+   * The settings are read from the environment
+   */
+  Test() {
+    if (const char* path = std::getenv("TEST_H_OUTPUT")) {
+      if (!setOutput(path))
+        std::cerr << "test.h: cannot open TEST_H_OUTPUT " << path << "\n";
+    }
+    if (const char* maxFailures = std::getenv("TEST_H_MAX_FAILURES"))
+      setMaxFailures(std::strtoull(maxFailures, nullptr, 10));
+    if (const char* name = std::getenv("TEST_H_REPORTER")) {
+      if (!setReporter(std::string_view(name)))
+        std::cerr << "test.h: unknown TEST_H_REPORTER " << name << "\n";
+    }
+    if (const char* counters = std::getenv("TEST_H_PERF_COUNTERS"))
+      setPerfCounters(std::string_view(counters) != "0");
+    if (const char* async = std::getenv("TEST_H_ASYNC"))
+      setAsync(std::string_view(async) != "0");
+  }
+
+  /**
+   * Print a summary of all tests at the end of program execution.
+   *
+   * Since the Test class is a static Singleton, destruction happens when the
+   * program terminates, so this is a good place to print the summary.
+   */
+  ~Test() {
+    flushAll();
+    setAsync(false);
+#ifdef TEST_H_WITH_MPI
+    if (mpiCollected_) {
+      reportAfterMpi();
+      return;
+    }
+#endif
+    const Summary counts = summary();
+    if (Reporter* reporter = activeReporter()) {
+      std::string out;
+      reporter->end(out, counts);
+      writeToSink(out, true);
+      return;
+    }
+    std::ostringstream report;
+    report << "\n--------------------------------------\n";
+    report << "Test summary:\n";
+    report << "Executed tests: " << counts.executed << "\n";
+    report << "Failed tests: " << counts.failed << "\n";
+    reportTimings(report);
+    reportCounters(report);
+    writeToSink(report.str(), true);
+  }
+
+  /**
+   * Print the hardware events of the tests, if they were counted
+   */
+  void reportCounters(std::ostream& report) {
+    std::lock_guard<std::mutex> lock(timingsMutex_);
+    if (countedTests_ == 0)
+      return;
+    if (counters_.empty()) {
+      report << "Hardware counters are not available on this system\n";
+      return;
+    }
+    report << "Hardware counters:\n";
+    for (const auto& [testCase, counts] : counters_) {
+      report << "  " << testCase.name << ": " << counts.cycles << " cycles, "
+             << counts.instructions << " instructions";
+      if (counts.cycles > 0)
+        report << " (" << std::fixed << std::setprecision(2)
+               << static_cast<double>(counts.instructions) / counts.cycles
+               << " per cycle)";
+      report << ", " << counts.cacheMisses << " cache misses, "
+             << counts.branchMisses << " branch misses\n";
+    }
+  }
+
+  /**
+   * Print the slowest tests, if timing is enabled
+   */
+  void reportTimings(std::ostream& report) {
+    std::lock_guard<std::mutex> lock(timingsMutex_);
+    const std::size_t count = std::min(slowestTests_, timings_.size());
+    if (count == 0)
+      return;
+    std::partial_sort(timings_.begin(), timings_.begin() + count,
+                      timings_.end(),
+                      [](const TestTiming& a, const TestTiming& b) {
+                        return a.seconds > b.seconds;
+                      });
+    double total = 0;
+    for (const TestTiming& timing : timings_)
+      total += timing.seconds;
+    report << "Slowest tests (of " << timings_.size() << ", "
+           << std::fixed << std::setprecision(3) << total * 1e3
+           << " ms in total):\n";
+    for (std::size_t i = 0; i < count; ++i) {
+      const TestTiming& timing = timings_[i];
+      report << std::setw(12) << timing.seconds * 1e3 << " ms  "
+             << timing.testCase.name << " (" << timing.checks << " checks, "
+             << timing.testCase.file << ":" << timing.testCase.line << ")\n";
+    }
+  }
+
+  /**
+   * Only the owning thread writes to its counters, so a plain increment is
+   * enough, the atomic just makes the concurrent read in summary() legal.
+   */
+  static void increment(std::atomic<std::uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  void registerPassingTest(ThreadState& state) {
+    increment(state.numTests);
+    if (state.test != nullptr)
+      state.test->checks++;
+  }
+
+  void registerFailingTest(ThreadState& state) {
+    increment(state.numTests);
+    increment(state.numFailedTests);
+    if (state.test != nullptr) {
+      state.test->checks++;
+      state.test->failures++;
+    }
+  }
+
+  ThreadState& threadState() {
+    static thread_local ThreadStateHandle handle;
+    if (handle.slot == nullptr) {
+      handle.slot = &threads_.acquire();
+      ThreadState& state = handle.slot->value;
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.text.reserve(TEST_H_BUFFER_SIZE);
+    }
+    return handle.slot->value;
+  }
+
+  void releaseThreadState(ThreadSlots<ThreadState>::Slot& slot) {
+    {
+      std::lock_guard<std::mutex> lock(slot.value.mutex);
+      flushBuffer(slot.value);
+    }
+    threads_.release(slot);
+  }
+
+  /**
+   * Format the result of a check into the buffer of the thread
+   */
+  void report(ThreadState& state, bool testResult, const Value& expectedValue,
+              const Value& actualValue, const SourceLocation& location) {
+    std::string& out = output(state);
+    if (Reporter* reporter = activeReporter()) {
+      state.expected.clear();
+      expectedValue.appendPlainTo(state.expected);
+      state.actual.clear();
+      actualValue.appendPlainTo(state.actual);
+      reporter->checked(out,
+                        CheckEvent{testResult, currentTestCase(state),
+                                   state.expected, state.actual, {}, location});
+      finishReport(state, testResult);
+      return;
+    }
+    if (async_.load(std::memory_order_acquire) && &out == &state.text &&
+        expectedValue.copyableSize() > 0 && actualValue.copyableSize() > 0) {
+      pushCheck(state, testResult, expectedValue, actualValue, location);
+      return;
+    }
+    if (testResult == true) {
+      out += "Test successful! Expected value == actual value (=";
+      expectedValue.appendTo(out);
+      out += ")\n";
+    } else {
+      appendErrorPrefix(out, currentTestCase(state), location);
+      out += "expected value ";
+      expectedValue.appendTo(out);
+      out += ", but actual value was ";
+      actualValue.appendTo(out);
+      out += "\n";
+    }
+    finishReport(state, testResult);
+  }
+
+  /**
+   * Hand a check to the writer thread instead of formatting it. The output
+   * that the thread has buffered before goes first, so its order is kept.
+   */
+  void pushCheck(ThreadState& state, bool testResult,
+                 const Value& expectedValue, const Value& actualValue,
+                 const SourceLocation& location) {
+    flushBuffer(state, false);
+    const TestCase* test = currentTestCase(state);
+    const bool flush =
+        !testResult && flushOnFailure_.load(std::memory_order_relaxed);
+    asyncQueue_->push([&](AsyncRecord& record) {
+      record.check = true;
+      record.passed = testResult;
+      record.flush = flush;
+      record.test = test;
+      record.location = location;
+      record.appendExpected = expectedValue.appendFunction();
+      std::memcpy(record.expected, expectedValue.object(),
+                  expectedValue.copyableSize());
+      record.appendActual = actualValue.appendFunction();
+      std::memcpy(record.actual, actualValue.object(),
+                  actualValue.copyableSize());
+    });
+  }
+
+  void report(ThreadState& state, bool testResult,
+              const MessageFunction& appendMessage,
+              const SourceLocation& location) {
+    std::string& out = output(state);
+    if (Reporter* reporter = activeReporter()) {
+      state.message.clear();
+      appendMessage(state.message);
+      reporter->checked(out, CheckEvent{testResult, currentTestCase(state), {},
+                                        {}, state.message, location});
+      finishReport(state, testResult);
+      return;
+    }
+    if (testResult)
+      out += "Test successful! ";
+    else
+      appendErrorPrefix(out, currentTestCase(state), location);
+    appendMessage(out);
+    out += "\n";
+    finishReport(state, testResult);
+  }
+
+  /**
+   * Count the result of a check, returns whether it has to be reported
+   */
+  bool registerTest(ThreadState& state, bool testResult) {
+#ifdef TEST_H_WITH_MPI
+    if (!mpiChecked_.load(std::memory_order_relaxed))
+      setUpMpi();
+#endif
+    if (state.test != nullptr && state.test->trial) {
+      state.test->checks++;
+      state.test->failures += !testResult;
+      return !testResult && state.test->replay;
+    }
+    if (testResult == true) {
+      registerPassingTest(state);
+      return verbosity_.load(std::memory_order_relaxed) != Verbosity::Quiet;
+    }
+    registerFailingTest(state);
+    const std::uint64_t failures =
+        failures_.fetch_add(1, std::memory_order_relaxed) + 1;
+    const std::uint64_t maxFailures =
+        maxFailures_.load(std::memory_order_relaxed);
+    if (maxFailures == 0 || failures <= maxFailures)
+      return true;
+    if (failures == maxFailures + 1) {
+      std::string note = "Reached the maximum of ";
+      appendNumber(note, maxFailures);
+      note += " failures, further failures are only counted\n";
+      std::lock_guard<std::mutex> lock(state.mutex);
+      appendNote(state, note);
+      finishReport(state, false);
+    }
+    return false;
+  }
+
+  void appendNote(ThreadState& state, std::string_view text) {
+    if (Reporter* reporter = activeReporter())
+      reporter->message(output(state), text);
+    else
+      output(state) += text;
+  }
+
+  /**
+   * Start of a failure report, e.g. "file.cpp:12: Error in test MyTest: "
+   */
+  static void appendErrorPrefix(std::string& out, const TestCase* testCase,
+                                const SourceLocation& location) {
+    if (location.file != nullptr) {
+      out += location.file;
+      out += ':';
+      appendNumber(out, location.line);
+      out += ": ";
+    }
+    out += "Error in test";
+    if (testCase != nullptr) {
+      out += ' ';
+      out += testCase->name;
+    }
+    out += ": ";
+  }
+
+  static const TestCase* currentTestCase(const ThreadState& state) {
+    return state.test != nullptr ? state.test->testCase : nullptr;
+  }
+
+  /**
+   * The reporter, if any. Its begin() is written before the first event.
+   */
+  Reporter* activeReporter() {
+    Reporter* reporter = reporter_.load(std::memory_order_acquire);
+    if (reporter != nullptr &&
+        !reporterStarted_.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(reporterMutex_);
+      if (!reporterStarted_.load()) {
+        std::string out;
+        reporter->begin(out);
+        writeToSink(out, true);
+        reporterStarted_.store(true, std::memory_order_release);
+      }
+    }
+    return reporter;
+  }
+
+  /**
+   * Reports go to the running test if its output is captured
+   */
+  static std::string& output(ThreadState& state) {
+    const bool capture = state.test != nullptr && state.test->capture;
+    return capture ? state.test->output : state.text;
+  }
+
+  void finishReport(ThreadState& state, bool testResult) {
+    const bool capture = state.test != nullptr && state.test->capture;
+    if (!capture)
+      commit(state, testResult == false &&
+                        flushOnFailure_.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * Called after a report was appended to the buffer
+   */
+  void commit(ThreadState& buffer, bool flush) {
+    if (flush || buffer.text.size() >= TEST_H_BUFFER_SIZE)
+      flushBuffer(buffer, flush);
+  }
+
+  void flushBuffer(ThreadState& buffer, bool flushSink = true) {
+    if (!buffer.text.empty())
+      writeToSink(buffer.text, flushSink);
+    buffer.text.clear();
+  }
+
+  /**
+   * Hand the output of all threads to the sink. Threads that are writing a
+   * report finish it first.
+   */
+  void flushAll() {
+    threads_.forEach([this](ThreadState& buffer) {
+      std::lock_guard<std::mutex> lock(buffer.mutex);
+      flushBuffer(buffer);
+    });
+    drainAsync();
+  }
+
+  /**
+   * Wait until the writer thread has written everything pushed so far
+   */
+  void drainAsync() {
+    if (!async_.load(std::memory_order_acquire))
+      return;
+    const std::uint64_t pushed = asyncQueue_->pushed();
+    while (asyncWritten_.load(std::memory_order_acquire) < pushed)
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+
+  /**
+   * Loop of the writer thread. The records are formatted into large chunks,
+   * which are written when they are full or the queue runs empty.
+   */
+  void runWriter() {
+    std::string out;
+    out.reserve(TEST_H_BUFFER_SIZE);
+    for (;;) {
+      const bool stop = asyncStop_.load(std::memory_order_acquire);
+      std::uint64_t written = 0;
+      bool flush = false;
+      const auto consume = [&out, &flush](AsyncRecord& record) {
+        appendRecord(out, record);
+        flush = flush || record.flush;
+      };
+      while (asyncQueue_->pop(consume)) {
+        ++written;
+        if (out.size() >= TEST_H_BUFFER_SIZE) {
+          writeDirect(out, flush);
+          out.clear();
+          flush = false;
+        }
+      }
+      if (written > 0) {
+        writeDirect(out, flush);
+        out.clear();
+        asyncWritten_.fetch_add(written, std::memory_order_release);
+      } else if (stop) {
+        return;
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    }
+  }
+
+  /**
+   * Format a record the same way as report() would have
+   */
+  static void appendRecord(std::string& out, AsyncRecord& record) {
+    if (!record.check) {
+      out += record.text;
+      record.text.clear();
+    } else if (record.passed) {
+      out += "Test successful! Expected value == actual value (=";
+      record.appendExpected(out, record.expected);
+      out += ")\n";
+    } else {
+      appendErrorPrefix(out, record.test, record.location);
+      out += "expected value ";
+      record.appendExpected(out, record.expected);
+      out += ", but actual value was ";
+      record.appendActual(out, record.actual);
+      out += "\n";
+    }
+  }
+
+#ifdef TEST_H_WITH_MPI
+  /**
+   * Called by the first check after MPI_Init(). Ranks other than 0 keep their
+   * output in memory and only record failing checks. A callback on
+   * MPI_COMM_SELF collects the results at the beginning of MPI_Finalize(),
+   * while communication is still possible.
+   */
+  void setUpMpi() {
+    int initialized = 0;
+    MPI_Initialized(&initialized);
+    if (!initialized)
+      return;
+    std::lock_guard<std::mutex> lock(mpiMutex_);
+    if (mpiChecked_.load())
+      return;
+    int finalized = 0;
+    MPI_Finalized(&finalized);
+    if (!finalized) {
+      int rank = 0;
+      MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+      if (rank != 0) {
+        verbosity_.store(Verbosity::Quiet);
+        // the output is appended to the one of rank 0
+        reporterStarted_.store(true);
+        // other threads may still be reporting. flushAll() waits for the
+        // reports in their buffers, and everything is written to a sink
+        // under sinkMutex_, so no write is in progress while it is swapped.
+        flushAll();
+        std::lock_guard<std::mutex> sinkLock(sinkMutex_);
+        mpiPreviousSink_ = sink_.exchange(&mpiFailures_);
+      }
+      int keyval = 0;
+      MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, &Test::onMpiFinalize,
+                             &keyval, nullptr);
+      MPI_Comm_set_attr(MPI_COMM_SELF, keyval, nullptr);
+    }
+    mpiSetUp_.store(!finalized);
+    mpiChecked_.store(true);
+  }
+
+  /**
+   * The checks after MPI_Finalize() are not part of the summary of all ranks,
+   * every rank prints its own summary of them
+   */
+  void reportAfterMpi() {
+    const Summary counts = summary();
+    const std::uint64_t executed =
+        counts.executed - mpiCollectedCounts_.executed;
+    if (executed == 0)
+      return;
+    std::ostringstream report;
+    report << "\n--------------------------------------\n";
+    report << "Test summary of rank " << mpiRank_ << " after MPI_Finalize():\n";
+    report << "Executed tests: " << executed << "\n";
+    report << "Failed tests: " << counts.failed - mpiCollectedCounts_.failed
+           << "\n";
+    if (Reporter* reporter = activeReporter()) {
+      std::string out;
+      reporter->message(out, report.str());
+      writeToSink(out, true);
+      return;
+    }
+    writeToSink(report.str(), true);
+  }
+
+  static int onMpiFinalize(MPI_Comm, int, void*, void*) {
+    instance().collectMpi();
+    return MPI_SUCCESS;
+  }
+#endif
+
+  /**
+   * Uses its own mutex instead of an OpenMP critical section, so it does not
+   * serialize against unnamed critical sections of the code under test.
+   */
+  void writeToSink(const std::string& text, bool flush) {
+    if (async_.load(std::memory_order_acquire)) {
+      asyncQueue_->push([&](AsyncRecord& record) {
+        record.check = false;
+        record.flush = flush;
+        record.text.assign(text);
+      });
+      return;
+    }
+    writeDirect(text, flush);
+  }
+
+  void writeDirect(const std::string& text, bool flush) {
+    std::lock_guard<std::mutex> lock(sinkMutex_);
+    Sink* sink = sink_.load();
+    sink->write(text.data(), text.size());
+    if (flush)
+      sink->flush();
+  }
+
+  /**
+   * Output level, read on every check
+   */
+#ifdef TEST_H_QUIET
+  std::atomic<Verbosity> verbosity_ = Verbosity::Quiet;
+#else
+  std::atomic<Verbosity> verbosity_ = Verbosity::Normal;
+#endif
+
+  std::atomic<bool> flushOnFailure_ = true;
+
+  std::atomic<std::uint64_t> maxFailures_ = 0;
+  std::atomic<std::uint64_t> failures_ = 0;
+
+  std::atomic<bool> timing_ = false;
+  std::size_t slowestTests_ = 0;
+  std::mutex timingsMutex_;
+  std::vector<TestTiming> timings_;
+
+  std::atomic<bool> perfCounters_ = false;
+  std::size_t countedTests_ = 0;
+  std::vector<std::pair<TestCase, PerfCounts>> counters_;
+
+  StreamSink defaultSink_;
+  std::atomic<Sink*> sink_ = &defaultSink_;
+  std::unique_ptr<FileSink> fileSink_;
+  StringSink workerOutput_;
+
+  std::mutex reporterMutex_;
+  std::atomic<Reporter*> reporter_ = nullptr;
+  std::atomic<bool> reporterStarted_ = false;
+  std::unique_ptr<Reporter> ownedReporter_;
+
+  std::mutex sinkMutex_;
+  ThreadSlots<ThreadState> threads_;
+
+  // asynchronous mode, see setAsync()
+  std::mutex asyncMutex_;
+  std::atomic<bool> async_ = false;
+  std::atomic<bool> asyncStop_ = false;
+  std::atomic<std::uint64_t> asyncWritten_ = 0;
+  std::unique_ptr<RecordQueue> asyncQueue_;
+  std::thread asyncWriter_;
+
+#ifdef TEST_H_WITH_MPI
+  std::mutex mpiMutex_;
+  std::atomic<bool> mpiSetUp_ = false;
+  // set once MPI was found initialized, also if it was finalized already, so
+  // the checks do not look at MPI any more
+  std::atomic<bool> mpiChecked_ = false;
+  bool mpiCollected_ = false;
+  // counts of this rank that went into the summary of all ranks
+  Summary mpiCollectedCounts_;
+  int mpiRank_ = 0;
+  StringSink mpiFailures_;
+  Sink* mpiPreviousSink_ = nullptr;
+#endif
+};
+
+/**
+ * Match a name against a glob pattern with the wildcards * and ?
+ */
+inline bool matchGlob(std::string_view pattern, std::string_view text) {
+  constexpr std::size_t none = std::string_view::npos;
+  std::size_t p = 0;
+  std::size_t t = 0;
+  std::size_t star = none;
+  std::size_t starText = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+      ++p;
+      ++t;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      starText = t;
+    } else if (star != none) {
+      // let the last * match one more character
+      p = star + 1;
+      t = ++starText;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*')
+    ++p;
+  return p == pattern.size();
+}
+
+/**
+ * A filter is a list of glob patterns separated by ':'. A name passes if it
+ * matches one of the patterns, or if there are only negative patterns,
+ * which start with '-', and it matches none of them.
+ */
+inline bool matchFilter(std::string_view filter, std::string_view name) {
+  bool positive = false;
+  bool matched = false;
+  while (!filter.empty()) {
+    const std::size_t end = std::min(filter.find(':'), filter.size());
+    std::string_view pattern = filter.substr(0, end);
+    filter.remove_prefix(std::min(end + 1, filter.size()));
+    if (!pattern.empty() && pattern.front() == '-') {
+      if (matchGlob(pattern.substr(1), name))
+        return false;
+    } else if (!pattern.empty()) {
+      positive = true;
+      matched = matched || matchGlob(pattern, name);
+    }
+  }
+  return matched || !positive;
+}
+
+/**
+ * Settings of check_golden(), read from the environment on first use
+ */
+class GoldenOptions {
+ public:
+  static GoldenOptions& instance() {
+    static GoldenOptions options;
+    return options;
+  }
+
+  std::string directory() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return directory_;
+  }
+
+  void setDirectory(std::string_view directory) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    directory_ = directory;
+  }
+
+  /**
+   * Write the golden files instead of comparing with them
+   */
+  std::atomic<bool> update = false;
+
+ private:
+  GoldenOptions() {
+    if (const char* directory = std::getenv("TEST_H_GOLDEN_DIR"))
+      directory_ = directory;
+    if (const char* value = std::getenv("TEST_H_UPDATE_GOLDEN"))
+      update = std::string_view(value) != "0";
+  }
+
+  mutable std::mutex mutex_;
+  std::string directory_ = "golden";
+};
+
+/**
+ * One-sided Mann-Whitney U test whether the values of b tend to be larger
+ * than those of a. Returns the p-value of the normal approximation with tie
+ * and continuity correction, which is good enough from about 8 values each.
+ */
+inline double mannWhitneyGreater(const std::vector<double>& a,
+                                 const std::vector<double>& b) {
+  const std::size_t n = a.size() + b.size();
+  if (a.empty() || b.empty())
+    return 1;
+  std::vector<std::pair<double, bool>> values;
+  values.reserve(n);
+  for (double value : a)
+    values.emplace_back(value, false);
+  for (double value : b)
+    values.emplace_back(value, true);
+  std::sort(values.begin(), values.end());
+
+  // ranks from 1 to n, tied values get the mean of their ranks
+  double rankSum = 0;
+  double ties = 0;
+  for (std::size_t begin = 0; begin < n;) {
+    std::size_t end = begin + 1;
+    while (end < n && values[end].first == values[begin].first)
+      ++end;
+    const double rank = (begin + 1 + end) / 2.0;
+    for (std::size_t i = begin; i < end; ++i)
+      rankSum += values[i].second ? rank : 0;
+    const double count = static_cast<double>(end - begin);
+    ties += count * count * count - count;
+    begin = end;
+  }
+  const double na = static_cast<double>(a.size());
+  const double nb = static_cast<double>(b.size());
+  const double u = rankSum - nb * (nb + 1) / 2;
+  const double variance =
+      na * nb / 12 * ((n + 1) - ties / (static_cast<double>(n) * (n - 1)));
+  if (variance <= 0)
+    return 1;
+  const double z = (u - na * nb / 2 - 0.5) / std::sqrt(variance);
+  return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+/**
+ * Stored results of benchmarks, one JSON line per benchmark and machine:
+ *   {"name":"Sum","machine":"ci-1","samples":[357.2,356.9,...]}
+ * with the samples in nanoseconds per iteration. A benchmark with a baseline
+ * is a check that fails if it is significantly slower than the baseline
+ * times 1 + threshold. Settings are read from the environment on first use.
+ */
+class Baselines {
+ public:
+  static Baselines& instance() {
+    static Baselines baselines;
+    return baselines;
+  }
+
+  void setPath(std::string_view path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    path_ = path;
+    loaded_ = false;
+  }
+
+  void setMachine(std::string_view machine) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    machine_ = machine;
+  }
+
+  /**
+   * Store the samples as new baselines instead of comparing with them
+   */
+  std::atomic<bool> update = false;
+
+  /**
+   * Allowed slowdown as a fraction of the baseline
+   */
+  std::atomic<double> threshold = 0.1;
+
+  /**
+   * Significance level of the test for a slowdown
+   */
+  static constexpr double significance = 0.01;
+
+  /**
+   * Compare the samples of a benchmark with its baseline, or store them in
+   * update mode. Does nothing without a baseline file.
+   */
+  void evaluate(const char* name, const BenchmarkResult& result) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (path_.empty())
+      return;
+    const TestResult* current = Test::instance().currentTest();
+    const SourceLocation location =
+        current != nullptr && current->testCase != nullptr
+            ? SourceLocation(current->testCase->file, current->testCase->line)
+            : SourceLocation();
+    const std::string path = path_;
+    const std::string machine = machine_;
+    Test& test = Test::instance();
+
+    if (update.load()) {
+      // other processes may have written the file since it was loaded
+      load();
+      Entry* entry = find(name, machine);
+      if (entry == nullptr)
+        entry = &entries_.emplace_back(Entry{name, machine, {}});
+      entry->samples = result.samples;
+      const bool written = save();
+      lock.unlock();
+      test.checkWithMessage(written, [&](std::string& out) {
+        out += "baseline of benchmark ";
+        out += name;
+        out += " on machine ";
+        out += machine;
+        out += written ? " written to " : " could not be written to ";
+        out += path;
+      }, location);
+      return;
+    }
+
+    if (!loaded_)
+      load();
+    const Entry* entry = find(name, machine);
+    if (entry == nullptr) {
+      lock.unlock();
+      test.note("Benchmark " + std::string(name) + ": no baseline for machine " +
+                machine + " in " + path + ", write it with --update-baseline\n");
+      return;
+    }
+    const double allowed = 1 + threshold.load();
+    std::vector<double> limits = entry->samples;
+    for (double& limit : limits)
+      limit *= allowed;
+    std::vector<double> sorted = entry->samples;
+    std::sort(sorted.begin(), sorted.end());
+    const std::size_t count = sorted.size();
+    const double median = count % 2 == 1
+                              ? sorted[count / 2]
+                              : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+    lock.unlock();
+
+    const double p = mannWhitneyGreater(limits, result.samples);
+    test.checkWithMessage(p >= significance, [&](std::string& out) {
+      const double change = median > 0 ? result.median / median - 1 : 0;
+      char numbers[128];
+      std::snprintf(numbers, sizeof(numbers),
+                    "%.1f%% %s than its baseline on machine ",
+                    std::abs(change) * 100, change >= 0 ? "slower" : "faster");
+      out += "benchmark ";
+      out += name;
+      out += " is ";
+      out += numbers;
+      out += machine;
+      std::snprintf(numbers, sizeof(numbers),
+                    " (median %.3f ns instead of %.3f ns, p = %.3g), at most "
+                    "%g%% slower is allowed",
+                    result.median, median, p, (allowed - 1) * 100);
+      out += numbers;
+    }, location);
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    std::string machine;
+    std::vector<double> samples;
+  };
+
+  Baselines() {
+    if (const char* path = std::getenv("TEST_H_BASELINE"))
+      path_ = path;
+    if (const char* value = std::getenv("TEST_H_UPDATE_BASELINE"))
+      update = std::string_view(value) != "0";
+    if (const char* value = std::getenv("TEST_H_REGRESSION_THRESHOLD"))
+      threshold = std::strtod(value, nullptr);
+    if (const char* machine = std::getenv("TEST_H_MACHINE")) {
+      machine_ = machine;
+      return;
+    }
+#ifdef TEST_H_POSIX
+    char host[256] = {};
+    if (gethostname(host, sizeof(host) - 1) == 0 && host[0] != '\0')
+      machine_ = host;
+#endif
+  }
+
+  Entry* find(std::string_view name, std::string_view machine) {
+    for (Entry& entry : entries_) {
+      if (entry.name == name && entry.machine == machine)
+        return &entry;
+    }
+    return nullptr;
+  }
+
+  /**
+   * Read the file, lines that cannot be parsed are skipped
+   */
+  void load() {
+    loaded_ = true;
+    entries_.clear();
+    std::FILE* file = std::fopen(path_.c_str(), "rb");
+    if (file == nullptr)
+      return;
+    std::string content;
+    char buffer[4096];
+    std::size_t size = 0;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+      content.append(buffer, size);
+    std::fclose(file);
+
+    std::string_view text = content;
+    while (!text.empty()) {
+      const std::size_t end = std::min(text.find('\n'), text.size());
+      const std::string_view line = text.substr(0, end);
+      text.remove_prefix(std::min(end + 1, text.size()));
+      Entry entry;
+      if (readString(line, "\"name\":", entry.name) &&
+          readString(line, "\"machine\":", entry.machine) &&
+          readNumbers(line, "\"samples\":", entry.samples))
+        entries_.push_back(std::move(entry));
+    }
+  }
+
+  bool save() const {
+    std::string content;
+    for (const Entry& entry : entries_) {
+      content += "{\"name\":";
+      appendJson(content, entry.name);
+      content += ",\"machine\":";
+      appendJson(content, entry.machine);
+      content += ",\"samples\":[";
+      for (std::size_t i = 0; i < entry.samples.size(); ++i) {
+        if (i > 0)
+          content += ',';
+        appendNumber(content, entry.samples[i]);
+      }
+      content += "]}\n";
+    }
+    std::FILE* file = std::fopen(path_.c_str(), "wb");
+    if (file == nullptr)
+      return false;
+    const bool written =
+        std::fwrite(content.data(), 1, content.size(), file) == content.size();
+    return std::fclose(file) == 0 && written;
+  }
+
+  /**
+   * The JSON string after key in line, with the escapes written by appendJson
+   */
+  static bool readString(std::string_view line, std::string_view key,
+                         std::string& value) {
+    std::size_t i = line.find(key);
+    if (i == std::string_view::npos)
+      return false;
+    i += key.size();
+    if (i >= line.size() || line[i] != '"')
+      return false;
+    for (++i; i < line.size() && line[i] != '"'; ++i) {
+      if (line[i] != '\\') {
+        value += line[i];
+        continue;
+      }
+      if (++i >= line.size())
+        return false;
+      switch (line[i]) {
+        case 'n': value += '\n'; break;
+        case 'r': value += '\r'; break;
+        case 't': value += '\t'; break;
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'u': {
+          unsigned code = 0;
+          if (i + 4 >= line.size() ||
+              std::from_chars(line.data() + i + 1, line.data() + i + 5, code,
+                              16)
+                      .ptr != line.data() + i + 5)
+            return false;
+          value += static_cast<char>(code);
+          i += 4;
+          break;
+        }
+        default: value += line[i];
+      }
+    }
+    return i < line.size();
+  }
+
+  /**
+   * The JSON array of numbers after key in line
+   */
+  static bool readNumbers(std::string_view line, std::string_view key,
+                          std::vector<double>& values) {
+    std::size_t i = line.find(key);
+    if (i == std::string_view::npos || i + key.size() >= line.size() ||
+        line[i + key.size()] != '[')
+      return false;
+    const std::size_t end = line.find(']', i);
+    if (end == std::string_view::npos)
+      return false;
+    const std::string numbers(line.substr(i + key.size() + 1,
+                                          end - i - key.size() - 1));
+    const char* position = numbers.c_str();
+    while (*position != '\0') {
+      char* next = nullptr;
+      const double value = std::strtod(position, &next);
+      if (next == position)
+        return false;
+      values.push_back(value);
+      position = next;
+      if (*position == ',')
+        ++position;
+    }
+    return !values.empty();
+  }
+
+  std::mutex mutex_;
+  std::string path_;
+  std::string machine_ = "unknown";
+  bool loaded_ = false;
+  std::vector<Entry> entries_;
+};
+
+/**
+ * Tests registered for Test::runAll(). The nodes and the head of the list are
+ * constant-initialized, so a test can be registered during the dynamic
+ * initialization of any translation unit, before or after any other global
+ * object is constructed. Registration is a lock-free push, e.g. for shared
+ * libraries loaded by several threads, the order is restored by tests().
+ */
+class TestRegistry {
+ public:
+  static void add(TestNode& node) {
+    TestNode* head = head_.load(std::memory_order_relaxed);
+    do {
+      node.next = head;
+    } while (!head_.compare_exchange_weak(head, &node,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+
+  /**
+   * The registered tests in the order of registration
+   */
+  static std::vector<const TestCase*> tests() {
+    std::vector<const TestCase*> result;
+    for (const TestNode* node = head_.load(std::memory_order_acquire);
+         node != nullptr; node = node->next)
+      result.push_back(&node->testCase);
+    std::reverse(result.begin(), result.end());
+    return result;
+  }
+
+ private:
+  TEST_H_CONSTINIT static inline std::atomic<TestNode*> head_{nullptr};
+};
+
+#ifdef TEST_H_POSIX
+/**
+ * Bytes sent from a worker process to the runner through shared memory, with
+ * one writer and one reader. Both positions only grow, the position in the
+ * ring is taken modulo the capacity.
+ */
+struct SharedRing {
+  static constexpr std::size_t capacity = 64 * 1024;
+  // the processes only share memory, so the atomics must not use locks
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+  alignas(TEST_H_CACHE_LINE) std::atomic<std::uint64_t> written = 0;
+  alignas(TEST_H_CACHE_LINE) std::atomic<std::uint64_t> read = 0;
+  char data[capacity];
+
+  /**
+   * Called by the worker, waits while the ring is full
+   */
+  void push(const void* bytes, std::size_t size) {
+    const char* source = static_cast<const char*>(bytes);
+    std::uint64_t position = written.load(std::memory_order_relaxed);
+    while (size > 0) {
+      const std::uint64_t free =
+          capacity - (position - read.load(std::memory_order_acquire));
+      if (free == 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        continue;
+      }
+      const std::size_t offset = static_cast<std::size_t>(position % capacity);
+      const std::size_t length = static_cast<std::size_t>(
+          std::min<std::uint64_t>({size, free, capacity - offset}));
+      std::memcpy(data + offset, source, length);
+      source += length;
+      size -= length;
+      position += length;
+      written.store(position, std::memory_order_release);
+    }
+  }
+
+  /**
+   * Called by the runner, appends all bytes written so far to out. Returns
+   * false if there were none.
+   */
+  bool pop(std::string& out) {
+    std::uint64_t position = read.load(std::memory_order_relaxed);
+    const std::uint64_t end = written.load(std::memory_order_acquire);
+    if (position == end)
+      return false;
+    while (position < end) {
+      const std::size_t offset = static_cast<std::size_t>(position % capacity);
+      const std::size_t length = static_cast<std::size_t>(
+          std::min<std::uint64_t>(end - position, capacity - offset));
+      out.append(data + offset, length);
+      position += length;
+    }
+    read.store(position, std::memory_order_release);
+    return true;
+  }
+};
+
+/**
+ * Shared by the runner and all of its worker processes, followed by one ring
+ * per worker
+ */
+struct alignas(TEST_H_CACHE_LINE) WorkerControl {
+  std::atomic<std::uint64_t> nextTest = 0;
+  std::atomic<bool> stop = false;
+};
+
+/**
+ * Sent by a worker when it starts a test and, followed by size bytes of
+ * output, when the test has finished. Executed and failed count all checks
+ * of the worker during the test, also those in other threads.
+ */
+struct WorkerMessage {
+  enum Kind : std::uint32_t { Started, Finished };
+  Kind kind = Started;
+  std::uint32_t skipped = 0;
+  std::uint64_t test = 0;
+  std::uint64_t checks = 0;
+  std::uint64_t failures = 0;
+  std::uint64_t executed = 0;
+  std::uint64_t failed = 0;
+  double seconds = 0;
+  PerfCounts counters;
+  std::uint64_t size = 0;
+};
+#endif
+
+/**
+ * Runs the tests registered with the TEST macro.
+ *
+ * With more than one thread, the tests are distributed over a pool of
+ * threads. Each thread works on its own queue of tests and steals from the
+ * other queues when its own is empty, so long tests do not hold back the
+ * short ones. The output of each test is collected and printed in the order
+ * of registration as soon as all previous tests are finished.
+ * Checks in threads started by a test itself are not attributed to the test
+ * and printed directly.
+ *
+ * With worker processes, the runner forks the workers and they take the
+ * tests one by one from a shared counter. Each worker sends its results
+ * through a ring in shared memory. If a worker dies during a test, the test
+ * fails and a new worker takes over the remaining tests.
+ */
+class Runner {
+ public:
+  static Runner& instance() {
+    static Runner runner;
+    return runner;
+  }
+
+  /**
+   * Number of threads used by runAll(), 0 selects one thread per core
+   */
+  void setThreads(unsigned threads) {
+    threads_ = threads != 0 ? threads : std::thread::hardware_concurrency();
+    if (threads_ == 0)
+      threads_ = 1;
+  }
+
+  /**
+   * Number of worker processes used by runAll(), 0 runs the tests in this
+   * process
+   */
+  void setProcesses(unsigned processes) { processes_ = processes; }
+
+  /**
+   * Run all registered tests.
+   * Returns true if no check failed in the meantime.
+   */
+  bool runAll() {
+    const std::uint64_t failedBefore = Test::instance().summary().failed;
+    std::vector<TestResult> results;
+    std::vector<TestResult> benchmarks;
+    for (const TestCase* testCase : selectTests())
+      (testCase->benchmark ? benchmarks : results).emplace_back().testCase =
+          testCase;
+
+    const unsigned threads = static_cast<unsigned>(
+        std::min<std::size_t>(threads_, results.size()));
+    if (processes_ > 0) {
+      runProcesses(results, processes_);
+    } else if (threads <= 1) {
+      for (TestResult& result : results)
+        run(result);
+    } else {
+      runParallel(results, threads);
+    }
+    // benchmarks run one after the other so they do not disturb each other
+    if (processes_ > 0) {
+      runProcesses(benchmarks, 1);
+    } else {
+      for (TestResult& result : benchmarks)
+        run(result);
+    }
+    if (!recordTimingsPath_.empty()) {
+      results.insert(results.end(), benchmarks.begin(), benchmarks.end());
+      writeTimings(results);
+    }
+    return Test::instance().summary().failed == failedBefore;
+  }
+
+  /**
+   * Apply the command line options --filter=, --shard=, --timings=,
+   * --record-timings=, --processes=, --update-golden, --baseline=,
+   * --update-baseline and --list, other
+   * arguments are ignored. Returns false
+   * if an option is invalid. With --list, the selected tests are printed and
+   * list is set, instead of running them.
+   */
+  bool parseArguments(int argc, char** argv, bool& list) {
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+      const std::string_view argument = argv[i];
+      if (argument.substr(0, 9) == "--filter=") {
+        setFilter(argument.substr(9));
+      } else if (argument.substr(0, 8) == "--shard=") {
+        if (!setShard(argument.substr(8))) {
+          std::cerr << "test.h: invalid option " << argument << "\n";
+          valid = false;
+        }
+      } else if (argument.substr(0, 10) == "--timings=") {
+        setTimingsFile(argument.substr(10));
+      } else if (argument.substr(0, 17) == "--record-timings=") {
+        setRecordTimingsFile(argument.substr(17));
+      } else if (argument.substr(0, 12) == "--processes=") {
+        unsigned processes = 0;
+        const std::string_view number = argument.substr(12);
+        if (std::from_chars(number.data(), number.data() + number.size(),
+                            processes)
+                .ec != std::errc()) {
+          std::cerr << "test.h: invalid option " << argument << "\n";
+          valid = false;
+        }
+        setProcesses(processes);
+      } else if (argument == "--update-golden") {
+        GoldenOptions::instance().update = true;
+      } else if (argument.substr(0, 11) == "--baseline=") {
+        Baselines::instance().setPath(argument.substr(11));
+      } else if (argument == "--update-baseline") {
+        Baselines::instance().update = true;
+      } else if (argument == "--list") {
+        list = true;
+      }
+    }
+    return valid;
+  }
+
+  /**
+   * Print the names of the tests selected by the filter and the shard
+   */
+  void list() {
+    std::string out;
+    for (const TestCase* testCase : selectTests()) {
+      out += testCase->name;
+      out += '\n';
+    }
+    Test::instance().write(out);
+  }
+
+  void setFilter(std::string_view filter) { filter_ = filter; }
+
+  /**
+   * Run only the tests of shard index of count, both given as "index/count"
+   * with 0 <= index < count
+   */
+  bool setShard(std::string_view shard) {
+    const std::size_t slash = shard.find('/');
+    unsigned index = 0;
+    unsigned count = 0;
+    if (slash == std::string_view::npos ||
+        std::from_chars(shard.data(), shard.data() + slash, index).ec !=
+            std::errc() ||
+        std::from_chars(shard.data() + slash + 1, shard.data() + shard.size(),
+                        count)
+                .ec != std::errc())
+      return false;
+    return setShard(index, count);
+  }
+
+  bool setShard(unsigned index, unsigned count) {
+    if (count == 0 || index >= count)
+      return false;
+    shardIndex_ = index;
+    shardCount_ = count;
+    return true;
+  }
+
+  /**
+   * Read the durations of the tests from a previous run, written with
+   * --record-timings, to balance the shards by time instead of by number.
+   * Each line holds the seconds and the name of a test, later lines replace
+   * earlier ones, so the files of all shards can simply be concatenated.
+   * All shards must read the same file.
+   */
+  void setTimingsFile(std::string_view path) {
+    weights_.clear();
+    std::FILE* file = std::fopen(std::string(path).c_str(), "rb");
+    if (file == nullptr)
+      return;
+    std::string content;
+    char buffer[4096];
+    std::size_t size = 0;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+      content.append(buffer, size);
+    std::fclose(file);
+
+    std::string_view text = content;
+    while (!text.empty()) {
+      const std::size_t end = std::min(text.find('\n'), text.size());
+      const std::string_view line = text.substr(0, end);
+      text.remove_prefix(std::min(end + 1, text.size()));
+      const std::size_t space = line.find(' ');
+      if (space == std::string_view::npos)
+        continue;
+      const std::string number(line.substr(0, space));
+      char* numberEnd = nullptr;
+      const double seconds = std::strtod(number.c_str(), &numberEnd);
+      if (numberEnd != number.c_str() + number.size())
+        continue;
+      std::string_view name = line.substr(space + 1);
+      if (!name.empty() && name.back() == '\r')
+        name.remove_suffix(1);
+      weights_.emplace_back(std::string(name), seconds);
+    }
+  }
+
+  /**
+   * Write the durations of the tests of this run, for --timings
+   */
+  void setRecordTimingsFile(std::string_view path) { recordTimingsPath_ = path; }
+
+  /**
+   * Whether a test registered with TEST_H_AUTORUN runs. Only the filter and
+   * the hash of the name are available for them.
+   */
+  bool selected(const TestCase& testCase) const {
+    return matchFilter(filter_, testCase.name) &&
+           hashName(testCase.name) % shardCount_ == shardIndex_;
+  }
+
+  /**
+   * Execute a single test on the calling thread
+   */
+  void run(TestResult& result) {
+    using Clock = std::chrono::steady_clock;
+    Test& test = Test::instance();
+    if (test.failureLimitReached()) {
+      result.skipped = true;
+      if (!skipping_.exchange(true))
+        test.appendNote(
+            "Skipping the remaining tests after the maximum number of "
+            "failures\n");
+      return;
+    }
+    TestResult* previous = test.setCurrentTest(&result);
+    test.testStarted(result);
+    const bool timing = test.timing() && !result.testCase->benchmark;
+    const bool measure =
+        timing || test.reporting() || !recordTimingsPath_.empty();
+    const Clock::time_point start = measure ? Clock::now() : Clock::time_point();
+    std::optional<PerfCounters> counters;
+    if (test.perfCounters())
+      counters.emplace();
+    try {
+      result.testCase->function();
+    } catch (const RequireFailure&) {
+      // the failed check has been reported, the rest of the test is skipped
+    } catch (const std::exception& exception) {
+      exceptionThrown(result, exception.what());
+    } catch (...) {
+      exceptionThrown(result, nullptr);
+    }
+    if (counters) {
+      result.counters = counters->read();
+      test.recordCounters(result);
+    }
+    if (measure)
+      result.seconds =
+          std::chrono::duration<double>(Clock::now() - start).count();
+    if (timing)
+      test.recordTiming(result);
+    test.testFinished(result);
+    test.setCurrentTest(previous);
+  }
+
+ private:
+  /**
+   * Count an exception that escaped the code of a test as a failing check at
+   * the test, what is nullptr for an exception not derived from
+   * std::exception
+   */
+  static void exceptionThrown(const TestResult& result, const char* what) {
+    const TestCase& testCase = *result.testCase;
+    Test::instance().checkWithMessage(
+        false,
+        [&](std::string& out) {
+          if (what == nullptr) {
+            out += "unknown exception thrown";
+            return;
+          }
+          out += "exception thrown: ";
+          out += what;
+        },
+        SourceLocation(testCase.file, static_cast<unsigned>(testCase.line)));
+  }
+
+  Runner() {
+    if (const char* threads = std::getenv("TEST_H_THREADS"))
+      setThreads(static_cast<unsigned>(std::strtoul(threads, nullptr, 10)));
+    if (const char* processes = std::getenv("TEST_H_PROCESSES"))
+      setProcesses(
+          static_cast<unsigned>(std::strtoul(processes, nullptr, 10)));
+    if (const char* slowest = std::getenv("TEST_H_TIMING"))
+      Test::instance().setTiming(std::strtoul(slowest, nullptr, 10));
+    if (const char* filter = std::getenv("TEST_H_FILTER"))
+      setFilter(filter);
+    if (const char* shard = std::getenv("TEST_H_SHARD")) {
+      if (!setShard(std::string_view(shard)))
+        std::cerr << "test.h: invalid TEST_H_SHARD " << shard << "\n";
+    }
+    if (const char* timings = std::getenv("TEST_H_TIMINGS"))
+      setTimingsFile(timings);
+    if (const char* record = std::getenv("TEST_H_RECORD_TIMINGS"))
+      setRecordTimingsFile(record);
+  }
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::size_t> tests;
+  };
+
+  std::atomic<bool> skipping_ = false;
+
+  /**
+   * The registered tests that pass the filter and belong to the shard. Without
+   * timings the tests are distributed by the hash of their names. With
+   * timings, the longest tests are assigned first, each to the shard with
+   * the least time so far. Tests without a timing count with the average.
+   * Both only depend on the names and timings, so every machine computes the
+   * same shards.
+   */
+  std::vector<const TestCase*> selectTests() const {
+    std::vector<const TestCase*> tests;
+    for (const TestCase* testCase : TestRegistry::tests()) {
+      if (matchFilter(filter_, testCase->name))
+        tests.push_back(testCase);
+    }
+    if (shardCount_ == 1)
+      return tests;
+    if (weights_.empty()) {
+      tests.erase(std::remove_if(tests.begin(), tests.end(),
+                                 [this](const TestCase* testCase) {
+                                   return !selected(*testCase);
+                                 }),
+                  tests.end());
+      return tests;
+    }
+
+    double total = 0;
+    for (const auto& weight : weights_)
+      total += weight.second;
+    const double average = total / static_cast<double>(weights_.size());
+    struct Weighted {
+      const TestCase* testCase;
+      double seconds;
+      std::uint64_t hash;
+      std::size_t index;
+    };
+    std::vector<Weighted> weighted;
+    for (std::size_t i = 0; i < tests.size(); ++i) {
+      double seconds = average;
+      // the last entry of a test counts
+      for (auto it = weights_.rbegin(); it != weights_.rend(); ++it) {
+        if (it->first == tests[i]->name) {
+          seconds = it->second;
+          break;
+        }
+      }
+      weighted.push_back({tests[i], seconds, hashName(tests[i]->name), i});
+    }
+    std::sort(weighted.begin(), weighted.end(),
+              [](const Weighted& a, const Weighted& b) {
+                if (a.seconds != b.seconds)
+                  return a.seconds > b.seconds;
+                if (a.hash != b.hash)
+                  return a.hash < b.hash;
+                return std::strcmp(a.testCase->name, b.testCase->name) < 0;
+              });
+    std::vector<double> load(shardCount_, 0.0);
+    std::vector<std::size_t> own;
+    for (const Weighted& test : weighted) {
+      const std::size_t shard = static_cast<std::size_t>(
+          std::min_element(load.begin(), load.end()) - load.begin());
+      load[shard] += test.seconds;
+      if (shard == shardIndex_)
+        own.push_back(test.index);
+    }
+    // keep the order of registration within the shard
+    std::sort(own.begin(), own.end());
+    std::vector<const TestCase*> result;
+    for (std::size_t index : own)
+      result.push_back(tests[index]);
+    return result;
+  }
+
+  void writeTimings(const std::vector<TestResult>& results) const {
+    std::FILE* file = std::fopen(recordTimingsPath_.c_str(), "wb");
+    if (file == nullptr)
+      return;
+    for (const TestResult& result : results) {
+      if (!result.skipped)
+        std::fprintf(file, "%.9g %s\n", result.seconds, result.testCase->name);
+    }
+    std::fclose(file);
+  }
+
+  /**
+   * Take the next test from the own queue, or steal one from the end of
+   * another queue. Tests are never added during the run, so if all queues
+   * are empty, the work is done.
+   */
+  static bool takeTest(std::vector<Queue>& queues, std::size_t self,
+                       std::size_t& index) {
+    {
+      std::lock_guard<std::mutex> lock(queues[self].mutex);
+      if (!queues[self].tests.empty()) {
+        index = queues[self].tests.front();
+        queues[self].tests.pop_front();
+        return true;
+      }
+    }
+    for (std::size_t i = 1; i < queues.size(); ++i) {
+      Queue& victim = queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tests.empty()) {
+        index = victim.tests.back();
+        victim.tests.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void runParallel(std::vector<TestResult>& results, unsigned threads) {
+    Test& test = Test::instance();
+    test.flush();
+
+    // neighbouring tests start on the same thread
+    std::vector<Queue> queues(threads);
+    for (std::size_t i = 0; i < results.size(); ++i)
+      queues[i * threads / results.size()].tests.push_back(i);
+
+    std::mutex printMutex;
+    std::vector<bool> finished(results.size(), false);
+    std::size_t nextToPrint = 0;
+
+    auto work = [&](std::size_t self) {
+      std::size_t index = 0;
+      while (takeTest(queues, self, index)) {
+        TestResult& result = results[index];
+        result.capture = true;
+        run(result);
+
+        std::lock_guard<std::mutex> lock(printMutex);
+        finished[index] = true;
+        while (nextToPrint < results.size() && finished[nextToPrint]) {
+          std::string output;
+          output.swap(results[nextToPrint].output);
+          if (!output.empty())
+            test.write(output, results[nextToPrint].failures > 0);
+          ++nextToPrint;
+        }
+      }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+      pool.emplace_back(work, i);
+    work(0);
+    for (std::thread& thread : pool)
+      thread.join();
+  }
+
+#ifdef TEST_H_POSIX
+  /**
+   * Run the tests in worker processes and print their output in the order of
+   * registration. Tests that no worker took, because fork() failed or the
+   * maximum number of failures was reached, are handled in this process.
+   */
+  void runProcesses(std::vector<TestResult>& results, unsigned processes) {
+    processes = static_cast<unsigned>(
+        std::min<std::size_t>(processes, results.size()));
+    if (processes == 0)
+      return;
+    const std::size_t bytes =
+        sizeof(WorkerControl) + processes * sizeof(SharedRing);
+    void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      for (TestResult& result : results)
+        run(result);
+      return;
+    }
+    WorkerControl& control = *new (memory) WorkerControl;
+    SharedRing* rings = reinterpret_cast<SharedRing*>(
+        static_cast<char*>(memory) + sizeof(WorkerControl));
+
+    constexpr std::uint64_t none = std::numeric_limits<std::uint64_t>::max();
+    struct Worker {
+      pid_t pid = -1;
+      std::string received;
+      std::uint64_t test = none;
+    };
+    std::vector<Worker> workers(processes);
+    Test& test = Test::instance();
+
+    std::vector<bool> finished(results.size(), false);
+    std::size_t nextToPrint = 0;
+    auto finish = [&](std::size_t index) {
+      finished[index] = true;
+      while (nextToPrint < results.size() && finished[nextToPrint]) {
+        std::string output;
+        output.swap(results[nextToPrint].output);
+        if (!output.empty())
+          test.write(output, results[nextToPrint].failures > 0);
+        ++nextToPrint;
+      }
+    };
+
+    auto start = [&](std::size_t i) {
+      new (&rings[i]) SharedRing;
+      workers[i].received.clear();
+      test.prepareFork();
+      const pid_t pid = fork();
+      if (pid == 0)
+        runWorker(results, control, rings[i]);
+      workers[i].pid = pid;
+      return pid > 0;
+    };
+
+    // parse the complete messages received so far
+    auto receive = [&](std::size_t i) {
+      Worker& worker = workers[i];
+      if (!rings[i].pop(worker.received))
+        return false;
+      std::size_t offset = 0;
+      WorkerMessage message;
+      while (worker.received.size() - offset >= sizeof(message)) {
+        std::memcpy(&message, worker.received.data() + offset,
+                    sizeof(message));
+        if (message.kind == WorkerMessage::Started) {
+          worker.test = message.test;
+          offset += sizeof(message);
+          continue;
+        }
+        if (worker.received.size() - offset - sizeof(message) < message.size)
+          break;
+        TestResult& result = results[message.test];
+        result.checks = message.checks;
+        result.failures = message.failures;
+        result.seconds = message.seconds;
+        result.counters = message.counters;
+        result.skipped = message.skipped != 0;
+        result.output.assign(worker.received.data() + offset + sizeof(message),
+                             message.size);
+        offset += sizeof(message) + message.size;
+        worker.test = none;
+        test.addForwarded(result, message.executed, message.failed);
+        // the workers only see their own failures
+        if (test.failureLimitReached())
+          control.stop.store(true);
+        finish(message.test);
+      }
+      worker.received.erase(0, offset);
+      return true;
+    };
+
+    unsigned running = 0;
+    for (std::size_t i = 0; i < workers.size() && !test.failureLimitReached();
+         ++i)
+      running += start(i);
+    while (running > 0) {
+      bool received = false;
+      for (std::size_t i = 0; i < workers.size(); ++i) {
+        Worker& worker = workers[i];
+        if (worker.pid <= 0)
+          continue;
+        received = receive(i) || received;
+        int status = 0;
+        if (waitpid(worker.pid, &status, WNOHANG) != worker.pid)
+          continue;
+        // the last messages may have arrived after the previous receive()
+        receive(i);
+        worker.pid = -1;
+        --running;
+        if (worker.test == none)
+          continue;
+        reportExit(results[worker.test], status);
+        finish(worker.test);
+        worker.test = none;
+        if (!test.failureLimitReached() &&
+            control.nextTest.load() < results.size())
+          running += start(i);
+      }
+      if (!received)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    for (std::uint64_t index = control.nextTest.fetch_add(1);
+         index < results.size(); index = control.nextTest.fetch_add(1)) {
+      results[index].capture = true;
+      run(results[index]);
+      finish(index);
+    }
+    munmap(memory, bytes);
+  }
+
+  /**
+   * Main loop of a worker process, which never returns
+   */
+  [[noreturn]] void runWorker(std::vector<TestResult>& results,
+                              WorkerControl& control, SharedRing& ring) {
+    Test& test = Test::instance();
+    test.startWorker();
+    for (;;) {
+      // the runner skips the remaining tests
+      if (test.failureLimitReached())
+        control.stop.store(true);
+      if (control.stop.load())
+        break;
+      const std::uint64_t index = control.nextTest.fetch_add(1);
+      if (index >= results.size())
+        break;
+      WorkerMessage message;
+      message.test = index;
+      ring.push(&message, sizeof(message));
+
+      TestResult& result = results[index];
+      const Summary before = test.summary();
+      run(result);
+      const Summary after = test.summary();
+      const std::string output = test.takeWorkerOutput();
+      message.kind = WorkerMessage::Finished;
+      message.skipped = result.skipped;
+      message.checks = result.checks;
+      message.failures = result.failures;
+      message.executed = after.executed - before.executed;
+      message.failed = after.failed - before.failed;
+      message.seconds = result.seconds;
+      message.counters = result.counters;
+      message.size = output.size();
+      ring.push(&message, sizeof(message));
+      ring.push(output.data(), output.size());
+    }
+    // neither the summary nor anything else of the runner is repeated here
+    _exit(0);
+  }
+
+  /**
+   * Fail a test whose worker process ended before the test was finished
+   */
+  void reportExit(TestResult& result, int status) {
+    Test& test = Test::instance();
+    result.capture = true;
+    TestResult* previous = test.setCurrentTest(&result);
+    test.testStarted(result);
+    test.checkWithMessage(
+        false,
+        [status](std::string& out) {
+          if (WIFSIGNALED(status)) {
+            out += "the worker process was killed by signal ";
+            appendNumber(out, WTERMSIG(status));
+            if (const char* name = strsignal(WTERMSIG(status))) {
+              out += " (";
+              out += name;
+              out += ')';
+            }
+          } else {
+            out += "the worker process exited with status ";
+            appendNumber(out, WEXITSTATUS(status));
+          }
+          out += " during the test";
+        },
+        SourceLocation(result.testCase->file,
+                       static_cast<unsigned>(result.testCase->line)));
+    test.testFinished(result);
+    test.setCurrentTest(previous);
+  }
+#else
+  /**
+   * Without fork() the tests run in this process
+   */
+  void runProcesses(std::vector<TestResult>& results, unsigned) {
+    for (TestResult& result : results)
+      run(result);
+  }
+#endif
+
+  unsigned threads_ = 1;
+  unsigned processes_ = 0;
+  std::string filter_;
+  unsigned shardIndex_ = 0;
+  unsigned shardCount_ = 1;
+  std::vector<std::pair<std::string, double>> weights_;
+  std::string recordTimingsPath_;
+};
+
+TEST_H_API Registrar::Registrar(TestNode& node, bool autorun) {
+  if (!autorun) {
+    TestRegistry::add(node);
+  } else if (Runner::instance().selected(node.testCase)) {
+    TestResult result;
+    result.testCase = &node.testCase;
+    Runner::instance().run(result);
+  }
+}
+
+TEST_H_API bool checkCompared(bool testResult, const Value& expectedValue,
+                              const Value& actualValue,
+                              const SourceLocation& location) {
+  return Test::instance().check(testResult, expectedValue, actualValue,
+                                location);
+}
+
+TEST_H_API bool checkString(std::string_view expectedValue,
+                            std::string_view actualValue,
+                            const SourceLocation& location) {
+  return Test::instance().checkString(expectedValue, actualValue, location);
+}
+
+TEST_H_API bool checkWithMessage(bool testResult,
+                                 const MessageFunction& appendMessage,
+                                 const SourceLocation& location) {
+  return Test::instance().checkWithMessage(testResult, appendMessage,
+                                           location);
+}
+
+TEST_H_API void requireFailed() { Test::instance().requireFailed(); }
+
+TEST_H_API TestResult* setCurrentTest(TestResult* test) {
+  return Test::instance().setCurrentTest(test);
+}
+
+TEST_H_API TestResult* currentTest() { return Test::instance().currentTest(); }
+
+TEST_H_API void createInstance() { Test::instance(); }
+
+TEST_H_API double steadySeconds() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * Header of a golden file, followed by the elements in the byte order of the
+ * machine that wrote it. The header fills a cache line, so the mapped
+ * elements are aligned.
+ */
+struct GoldenHeader {
+  char magic[8];
+  std::uint32_t byteOrder;
+  std::uint32_t type;
+  std::uint64_t count;
+  char reserved[40];
+};
+// the elements follow the header, which keeps them aligned in the file
+static_assert(sizeof(GoldenHeader) == 64 &&
+              sizeof(GoldenHeader) % alignof(std::max_align_t) == 0);
+
+inline constexpr char goldenMagic[8] = {'t', 'e', 's', 't', '.', 'h', 'g', '1'};
+inline constexpr std::uint32_t goldenByteOrder = 0x01020304;
+
+/**
+ * A golden file mapped into memory, or read into a buffer where mmap() is
+ * not available. Both are aligned for every arithmetic type, as are the
+ * elements after the header of 64 bytes.
+ */
+class GoldenFile {
+ public:
+  explicit GoldenFile(const std::string& path) {
+#ifdef TEST_H_POSIX
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+      return;
+    exists_ = true;
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+      void* memory = mmap(nullptr, static_cast<std::size_t>(status.st_size),
+                          PROT_READ, MAP_PRIVATE, descriptor, 0);
+      if (memory != MAP_FAILED) {
+        data_ = static_cast<const char*>(memory);
+        size_ = static_cast<std::size_t>(status.st_size);
+      }
+    }
+    close(descriptor);
+#else
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+      return;
+    exists_ = true;
+    long size = 0;
+    if (std::fseek(file, 0, SEEK_END) == 0 && (size = std::ftell(file)) > 0 &&
+        std::fseek(file, 0, SEEK_SET) == 0) {
+      // the storage of a std::string would not be aligned for the elements
+      const std::size_t bytes = static_cast<std::size_t>(size);
+      constexpr std::size_t unit = sizeof(std::max_align_t);
+      buffer_.resize((bytes + unit - 1) / unit);
+      data_ = reinterpret_cast<const char*>(buffer_.data());
+      size_ = std::fread(buffer_.data(), 1, bytes, file);
+    }
+    std::fclose(file);
+#endif
+  }
+
+  GoldenFile(const GoldenFile&) = delete;
+  GoldenFile& operator=(const GoldenFile&) = delete;
+
+  ~GoldenFile() {
+#ifdef TEST_H_POSIX
+    if (data_ != nullptr)
+      munmap(const_cast<char*>(data_), size_);
+#endif
+  }
+
+  bool exists() const { return exists_; }
+  const char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+ private:
+  bool exists_ = false;
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+#ifndef TEST_H_POSIX
+  std::vector<std::max_align_t> buffer_;
+#endif
+};
+
+/**
+ * Write a golden file next to its final path and move it there, so an
+ * interrupted update never leaves a partial file. Creates the directory of
+ * the golden files if necessary.
+ */
+inline bool writeGolden(const std::string& path, const std::string& directory,
+                        std::uint32_t type, const void* elements,
+                        std::size_t count, std::size_t elementSize) {
+  GoldenHeader header{};
+  std::memcpy(header.magic, goldenMagic, sizeof(header.magic));
+  header.byteOrder = goldenByteOrder;
+  header.type = type;
+  header.count = count;
+  const std::string temporary = path + ".tmp";
+  std::FILE* file = std::fopen(temporary.c_str(), "wb");
+#ifdef TEST_H_POSIX
+  if (file == nullptr && mkdir(directory.c_str(), 0777) == 0)
+    file = std::fopen(temporary.c_str(), "wb");
+#else
+  (void)directory;
+#endif
+  if (file == nullptr)
+    return false;
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 (count == 0 ||
+                  std::fwrite(elements, elementSize, count, file) == count);
+  written = std::fclose(file) == 0 && written;
+#ifdef _WIN32
+  // rename() does not replace existing files on Windows
+  if (written)
+    std::remove(path.c_str());
+#endif
+  if (written && std::rename(temporary.c_str(), path.c_str()) == 0)
+    return true;
+  std::remove(temporary.c_str());
+  return false;
+}
+
+TEST_H_API bool checkGoldenFile(std::string_view name, std::uint32_t type,
+                                std::size_t elementSize, const void* actual,
+                                std::size_t size, GoldenComparison compare,
+                                const SourceLocation& location) {
+  GoldenOptions& options = GoldenOptions::instance();
+  const std::string directory = options.directory();
+  std::string path = directory;
+  if (!path.empty() && path.back() != '/')
+    path += '/';
+  path += name;
+  path += ".golden";
+  const std::string source = "golden file " + path;
+
+  const GoldenFile file(path);
+  GoldenHeader header{};
+  const char* problem = nullptr;
+  if (!file.exists()) {
+    problem = "not found";
+  } else if (file.size() < sizeof(header)) {
+    problem = "is not a golden file";
+  } else {
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, goldenMagic, sizeof(header.magic)) != 0)
+      problem = "is not a golden file";
+    else if (header.byteOrder != goldenByteOrder)
+      problem = "was written with a different byte order";
+    else if (header.type != type)
+      problem = "holds elements of a different type";
+    else if ((file.size() - sizeof(header)) % elementSize != 0 ||
+             (file.size() - sizeof(header)) / elementSize != header.count)
+      problem = "has the wrong size";
+  }
+  const char* expected =
+      problem == nullptr ? file.data() + sizeof(header) : nullptr;
+
+  Test& test = Test::instance();
+  if (options.update.load()) {
+    const bool upToDate =
+        expected != nullptr && header.count == size &&
+        (size == 0 || std::memcmp(expected, actual, size * elementSize) == 0);
+    const bool written =
+        upToDate ||
+        writeGolden(path, directory, type, actual, size, elementSize);
+    return test.checkWithMessage(written, [&](std::string& out) {
+      out += source;
+      if (upToDate) {
+        out += " is up to date";
+      } else if (written) {
+        out += " written with ";
+        appendNumber(out, size);
+        out += " elements";
+      } else {
+        out += " could not be written";
+      }
+    }, location);
+  }
+  if (problem != nullptr) {
+    return test.checkWithMessage(false, [&](std::string& out) {
+      out += source;
+      out += ' ';
+      out += problem;
+      out += ", write it with --update-golden";
+    }, location);
+  }
+  return compare(actual, size, expected,
+                 static_cast<std::size_t>(header.count), location, source);
+}
+
+TEST_H_API bool checkAllocations(const Allocations& start,
+                                 std::uint64_t maxAllocations,
+                                 const SourceLocation& location) {
+  const Allocations& end = threadAllocations;
+  const std::uint64_t allocations = end.allocations - start.allocations;
+  const std::uint64_t bytes = end.bytes - start.bytes;
+  const bool tracked = allocationsTracked.load(std::memory_order_relaxed);
+  const bool testResult = tracked && allocations <= maxAllocations;
+  return Test::instance().checkWithMessage(testResult, [&](std::string& out) {
+    if (!tracked) {
+      out += "allocations are not tracked, define TEST_H_TRACK_ALLOCATIONS "
+             "in one source file";
+      return;
+    }
+    appendNumber(out, allocations);
+    out += " allocations (";
+    appendNumber(out, bytes);
+    out += testResult ? " bytes), at most " : " bytes), but at most ";
+    appendNumber(out, maxAllocations);
+    out += " allowed";
+  }, location);
+}
+
+TEST_H_API void reportInstances(const char* type, std::int64_t live,
+                                std::int64_t total, std::int64_t peak,
+                                std::size_t size) {
+  std::ostringstream report;
+  report << "The remaining number of objects of type " << type
+         << " at the end of the program is " << live;
+  if (live > 0)
+    report << " (NOT zero!)";
+  report << "\nThe total number of objects created was " << total
+         << "\nThe peak number of live objects was " << peak << " ("
+         << peak * static_cast<std::int64_t>(size) << " bytes)\n";
+  Test::instance().note(report.str());
+}
+
+TEST_H_API std::size_t findFailure(std::size_t cases,
+                                   const TestCase* testCase,
+                                   const CaseFunction& tryCase) {
+  constexpr std::size_t batchSize = 16;
+  // batches are taken in order, so all cases before the first failure are
+  // tried and the result does not depend on the threads
+  std::atomic<std::size_t> nextBatch = 0;
+  std::atomic<std::size_t> firstFailure = cases;
+  auto work = [&] {
+    TestResult trial;
+    trial.testCase = testCase;
+    trial.trial = true;
+    for (;;) {
+      const std::size_t begin = nextBatch.fetch_add(1) * batchSize;
+      if (begin >= firstFailure.load())
+        return;
+      const std::size_t end = std::min(begin + batchSize, cases);
+      for (std::size_t i = begin; i < end && i < firstFailure.load(); ++i) {
+        if (tryCase(i, trial))
+          continue;
+        std::size_t first = firstFailure.load();
+        while (i < first && !firstFailure.compare_exchange_weak(first, i)) {
+        }
+        break;
+      }
+    }
+  };
+  unsigned threads = PropertyOptions::instance().threads.load();
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = static_cast<unsigned>(std::min<std::size_t>(
+      threads, (cases + batchSize - 1) / batchSize));
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; ++i)
+    pool.emplace_back(work);
+  work();
+  for (std::thread& thread : pool)
+    thread.join();
+
+  return firstFailure.load();
+}
+
+TEST_H_API void replayCase(const TestCase* testCase,
+                           const CaseFunction& replay) {
+  TestResult trial;
+  trial.testCase = testCase;
+  trial.trial = true;
+  trial.replay = true;
+  TestResult* previous = setCurrentTest(&trial);
+  try {
+    replay(0, trial);
+  } catch (const RequireFailure&) {
+    // the failed check has been printed
+  } catch (const std::exception& exception) {
+    const std::string_view what = exception.what();
+    checkWithMessage(
+        false,
+        [&](std::string& out) {
+          out += "exception thrown: ";
+          out += what;
+        },
+        SourceLocation());
+  } catch (...) {
+    checkWithMessage(
+        false, [](std::string& out) { out += "unknown exception thrown"; },
+        SourceLocation());
+  }
+  setCurrentTest(previous);
+}
+
+/**
+ * Print a rate with a decimal prefix, e.g. 1.5 G
+ */
+inline void appendRate(std::ostream& out, double rate, const char* unit) {
+  const char* prefixes[] = {"", "k", "M", "G", "T"};
+  std::size_t prefix = 0;
+  while (rate >= 1000 && prefix < 4) {
+    rate /= 1000;
+    ++prefix;
+  }
+  out << ", " << rate << " " << prefixes[prefix] << unit << "/s";
+}
+
+/**
+ * The CPUs the process may run on, empty if threads cannot be pinned
+ */
+inline std::vector<int> allowedCpus() {
+  std::vector<int> cpus;
+#ifdef TEST_H_AFFINITY
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+    }
+  }
+#endif
+  return cpus;
+}
+
+/**
+ * Pin the calling thread to one CPU, returns false if that is not possible
+ */
+inline bool pinThread([[maybe_unused]] int cpu) {
+#ifdef TEST_H_AFFINITY
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+TEST_H_API void runStress(void (*function)(const Stress&), std::size_t threads,
+                          std::uint64_t iterations, const char* name) {
+  using Clock = std::chrono::steady_clock;
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  Test& test = Test::instance();
+  TestResult* parent = test.currentTest();
+  const std::vector<int> cpus = allowedCpus();
+
+  struct StressThread {
+    TestResult result;
+    int cpu = -1;
+    std::uint64_t iterations = 0;
+    Clock::time_point start;
+    Clock::time_point end;
+    std::string failures;
+    std::exception_ptr exception;
+  };
+  std::vector<StressThread> states(threads);
+  std::atomic<std::size_t> arrived = 0;
+  std::atomic<bool> stop = false;
+  auto work = [&](std::size_t index) {
+    StressThread& state = states[index];
+    state.result.testCase = parent != nullptr ? parent->testCase : nullptr;
+    state.result.capture = parent != nullptr && parent->capture;
+    if (!cpus.empty() && pinThread(cpus[index % cpus.size()]))
+      state.cpu = cpus[index % cpus.size()];
+    test.setCurrentTest(&state.result);
+    pendingReport().clear();
+
+    // spin until all threads are ready, so they really run at the same time
+    arrived.fetch_add(1, std::memory_order_acq_rel);
+    for (unsigned spins = 0; arrived.load(std::memory_order_acquire) < threads;
+         ++spins) {
+      if (spins >= 4096)
+        std::this_thread::yield();
+    }
+
+    Stress stress{index, threads, 0};
+    state.start = Clock::now();
+    try {
+      for (; stress.iteration < iterations &&
+             !stop.load(std::memory_order_relaxed);
+           ++stress.iteration)
+        function(stress);
+    } catch (const RequireFailure&) {
+      // the failed check has been reported, the other threads stop as well
+      stop.store(true);
+    } catch (...) {
+      state.exception = std::current_exception();
+      stop.store(true);
+    }
+    state.end = Clock::now();
+    state.iterations = stress.iteration;
+    test.setCurrentTest(nullptr);
+    // failures collected by a reporter for the end of the test
+    state.failures.swap(pendingReport());
+  };
+  // the output of the test so far comes before the one of its threads
+  test.flush();
+  std::vector<std::thread> pool;
+  for (std::size_t i = 0; i < threads; ++i)
+    pool.emplace_back(work, i);
+  for (std::thread& thread : pool)
+    thread.join();
+
+  Clock::time_point start = states.front().start;
+  Clock::time_point end = states.front().end;
+  std::uint64_t total = 0;
+  for (const StressThread& state : states) {
+    start = std::min(start, state.start);
+    end = std::max(end, state.end);
+    total += state.iterations;
+  }
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(3);
+  const double seconds = std::chrono::duration<double>(end - start).count();
+  report << "Stress test " << name << ": " << threads << " threads x "
+         << iterations << " iterations in " << seconds * 1e3 << " ms";
+  if (seconds > 0)
+    appendRate(report, total / seconds, "iterations");
+  report << "\n";
+  for (std::size_t i = 0; i < threads; ++i) {
+    StressThread& state = states[i];
+    if (parent != nullptr) {
+      parent->checks += state.result.checks;
+      parent->failures += state.result.failures;
+      parent->output += state.result.output;
+    }
+    pendingReport() += state.failures;
+    const double threadSeconds =
+        std::chrono::duration<double>(state.end - state.start).count();
+    report << "  thread " << i;
+    if (state.cpu >= 0)
+      report << " on cpu " << state.cpu;
+    report << ": " << state.iterations << " iterations in "
+           << threadSeconds * 1e3 << " ms";
+    if (threadSeconds > 0)
+      appendRate(report, state.iterations / threadSeconds, "iterations");
+    report << ", " << state.result.checks << " checks, "
+           << state.result.failures << " failed\n";
+  }
+  test.appendNote(report.str());
+
+  for (const StressThread& state : states) {
+    if (state.exception)
+      std::rethrow_exception(state.exception);
+  }
+}
+
+}  // namespace Test::Detail
+
+namespace Test {
+
+TEST_H_API PerfCounters::PerfCounters() {
+#ifdef TEST_H_PERF_EVENTS
+  static constexpr std::uint64_t events[] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  for (std::size_t i = 0; i < 4; ++i) {
+    perf_event_attr attributes{};
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = events[i];
+    // the group starts at once when its leader is enabled
+    attributes.disabled = i == 0;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_GROUP |
+                             PERF_FORMAT_TOTAL_TIME_ENABLED |
+                             PERF_FORMAT_TOTAL_TIME_RUNNING;
+    events_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0,
+                                          -1, i == 0 ? -1 : events_[0], 0));
+    if (events_[i] < 0) {
+      release();
+      return;
+    }
+  }
+  ioctl(events_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(events_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+TEST_H_API PerfCounters::~PerfCounters() { release(); }
+
+TEST_H_API PerfCounts PerfCounters::read() const {
+  PerfCounts counts;
+#ifdef TEST_H_PERF_EVENTS
+  if (!available())
+    return counts;
+  // number of events, time enabled, time running and the counts
+  std::uint64_t values[3 + 4] = {};
+  if (::read(events_[0], values, sizeof(values)) !=
+          static_cast<ssize_t>(sizeof(values)) ||
+      values[0] != 4 || values[2] == 0)
+    return counts;
+  // extrapolate if the events shared the hardware with others
+  const double scale = static_cast<double>(values[1]) / values[2];
+  auto scaled = [scale](std::uint64_t value) {
+    return static_cast<std::uint64_t>(value * scale);
+  };
+  counts.cycles = scaled(values[3]);
+  counts.instructions = scaled(values[4]);
+  counts.cacheMisses = scaled(values[5]);
+  counts.branchMisses = scaled(values[6]);
+  counts.available = true;
+#endif
+  return counts;
+}
+
+TEST_H_API void PerfCounters::release() {
+#ifdef TEST_H_PERF_EVENTS
+  for (int& event : events_) {
+    if (event >= 0)
+      close(event);
+    event = -1;
+  }
+#endif
+}
+
+TEST_H_API void Benchmark::evaluate() {
+  std::vector<double> sorted = result_.samples;
+  std::sort(sorted.begin(), sorted.end());
+  const std::size_t n = sorted.size();
+  result_.median = n % 2 == 1 ? sorted[n / 2]
+                              : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  result_.min = sorted.front();
+  double sum = 0;
+  for (double sample : sorted)
+    sum += sample;
+  result_.mean = sum / n;
+  double squares = 0;
+  for (double sample : sorted)
+    squares += (sample - result_.mean) * (sample - result_.mean);
+  result_.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+  if (result_.median > 0) {
+    result_.bytesPerSecond = bytesPerIteration_ * 1e9 / result_.median;
+    result_.itemsPerSecond = itemsPerIteration_ * 1e9 / result_.median;
+  }
+}
+
+TEST_H_API void Benchmark::report() {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3);
+  out << "Benchmark " << name_ << ": median " << result_.median
+      << " ns, min " << result_.min << " ns, stddev " << result_.stddev
+      << " ns per iteration (" << result_.samples.size() << " samples of "
+      << result_.iterations << " iterations)";
+  if (bytesPerIteration_ > 0)
+    Detail::appendRate(out, result_.bytesPerSecond, "B");
+  if (itemsPerIteration_ > 0)
+    Detail::appendRate(out, result_.itemsPerSecond, "items");
+  out << "\n";
+  Detail::Test& test = Detail::Test::instance();
+  test.flush();
+  test.note(out.str());
+  Detail::Baselines::instance().evaluate(name_, result_);
+}
+
+TEST_H_API void setVerbosity(Verbosity verbosity) {
+  Detail::Test::instance().setVerbosity(verbosity);
+}
+
+TEST_H_API void setSink(Sink* sink) {
+  Detail::Test::instance().setSink(sink);
+}
+
+TEST_H_API void setFlushOnFailure(bool flushOnFailure) {
+  Detail::Test::instance().setFlushOnFailure(flushOnFailure);
+}
+
+TEST_H_API void setAsync(bool async) {
+  Detail::Test::instance().setAsync(async);
+}
+
+TEST_H_API void flush() {
+  Detail::Test::instance().flush();
+}
+
+TEST_H_API Summary summary() {
+  return Detail::Test::instance().summary();
+}
+
+#ifdef TEST_H_WITH_MPI
+TEST_H_API void collectMpi() {
+  Detail::Test::instance().collectMpi();
+}
+#endif
+
+TEST_H_API int runAll() {
+  return Detail::Runner::instance().runAll() ? 0 : 1;
+}
+
+TEST_H_API int runAll(int argc, char** argv) {
+  Detail::Runner& runner = Detail::Runner::instance();
+  bool list = false;
+  if (!runner.parseArguments(argc, argv, list))
+    return 2;
+  if (list) {
+    runner.list();
+    return 0;
+  }
+  return runner.runAll() ? 0 : 1;
+}
+
+TEST_H_API void setFilter(std::string_view filter) {
+  Detail::Runner::instance().setFilter(filter);
+}
+
+TEST_H_API bool setShard(unsigned index, unsigned count) {
+  return Detail::Runner::instance().setShard(index, count);
+}
+
+TEST_H_API void setProcesses(unsigned processes) {
+  Detail::Runner::instance().setProcesses(processes);
+}
+
+TEST_H_API void setThreads(unsigned threads) {
+  Detail::Runner::instance().setThreads(threads);
+}
+
+TEST_H_API void setTiming(std::size_t slowestTests) {
+  Detail::Test::instance().setTiming(slowestTests);
+}
+
+TEST_H_API void setReporter(Reporter* reporter) {
+  Detail::Test::instance().setReporter(reporter);
+}
+
+TEST_H_API bool setReporter(std::string_view name) {
+  return Detail::Test::instance().setReporter(name);
+}
+
+TEST_H_API bool setOutput(const char* path) {
+  return Detail::Test::instance().setOutput(path);
+}
+
+TEST_H_API void setMaxFailures(std::uint64_t maxFailures) {
+  Detail::Test::instance().setMaxFailures(maxFailures);
+}
+
+TEST_H_API void setGoldenDirectory(std::string_view directory) {
+  Detail::GoldenOptions::instance().setDirectory(directory);
+}
+
+TEST_H_API void setUpdateGolden(bool update) {
+  Detail::GoldenOptions::instance().update = update;
+}
+
+TEST_H_API void setBaselineFile(std::string_view path) {
+  Detail::Baselines::instance().setPath(path);
+}
+
+TEST_H_API void setUpdateBaseline(bool update) {
+  Detail::Baselines::instance().update = update;
+}
+
+TEST_H_API void setRegressionThreshold(double threshold) {
+  Detail::Baselines::instance().threshold = threshold;
+}
+
+TEST_H_API void setMachine(std::string_view machine) {
+  Detail::Baselines::instance().setMachine(machine);
+}
+
+TEST_H_API void setPerfCounters(bool perfCounters) {
+  Detail::Test::instance().setPerfCounters(perfCounters);
+}
+
+}  // namespace Test
+
+#endif  // TEST_H_WITH_IMPLEMENTATION
+
+/**
+ * Replace the global operator new and delete to count the allocations of
+ * every thread. Define TEST_H_TRACK_ALLOCATIONS before including the header
+ * in exactly one source file of the program.
+ */
+#ifdef TEST_H_TRACK_ALLOCATIONS
+
+// The deallocation functions are not inlined into the replaced operator
+// delete. Otherwise the compiler sees operator new paired with free() and
+// warns with -Wmismatched-new-delete, although both come from here.
+#if defined(__GNUC__)
+#define TEST_H_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define TEST_H_NOINLINE __declspec(noinline)
+#else
+#define TEST_H_NOINLINE
+#endif
+
+namespace Test::Detail {
+
+inline void* allocate(std::size_t size) {
+  recordAllocation(size);
+  return std::malloc(size != 0 ? size : 1);
+}
+
+inline void* allocate(std::size_t size, std::align_val_t alignment) {
+  recordAllocation(size);
+  const std::size_t align = static_cast<std::size_t>(alignment);
+#ifdef _WIN32
+  return _aligned_malloc(size != 0 ? size : 1, align);
+#else
+  // aligned_alloc requires a size that is a multiple of the alignment
+  return std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) /
+                                      align * align);
+#endif
+}
+
+TEST_H_NOINLINE inline void deallocate(void* pointer) {
+  recordDeallocation(pointer);
+  std::free(pointer);
+}
+
+TEST_H_NOINLINE inline void deallocateAligned(void* pointer) {
+  recordDeallocation(pointer);
+#ifdef _WIN32
+  _aligned_free(pointer);
+#else
+  std::free(pointer);
+#endif
+}
+
+inline void* allocateOrThrow(void* pointer) {
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+// also for checks that run before the first allocation of the program
+static const bool allocationsTrackedSet =
+    (allocationsTracked.store(true, std::memory_order_relaxed), true);
+
+}  // namespace Test::Detail
+
+void* operator new(std::size_t size) {
+  return Test::Detail::allocateOrThrow(Test::Detail::allocate(size));
+}
+void* operator new[](std::size_t size) {
+  return Test::Detail::allocateOrThrow(Test::Detail::allocate(size));
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return Test::Detail::allocate(size);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return Test::Detail::allocate(size);
+}
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  return Test::Detail::allocateOrThrow(Test::Detail::allocate(size, alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return Test::Detail::allocateOrThrow(Test::Detail::allocate(size, alignment));
+}
+void* operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return Test::Detail::allocate(size, alignment);
+}
+void* operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return Test::Detail::allocate(size, alignment);
+}
+void operator delete(void* pointer) noexcept {
+  Test::Detail::deallocate(pointer);
+}
+void operator delete[](void* pointer) noexcept {
+  Test::Detail::deallocate(pointer);
+}
+void operator delete(void* pointer, std::size_t) noexcept {
+  Test::Detail::deallocate(pointer);
+}
+void operator delete[](void* pointer, std::size_t) noexcept {
+  Test::Detail::deallocate(pointer);
+}
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  Test::Detail::deallocate(pointer);
+}
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  Test::Detail::deallocate(pointer);
+}
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  Test::Detail::deallocateAligned(pointer);
+}
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  Test::Detail::deallocateAligned(pointer);
+}
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+  Test::Detail::deallocateAligned(pointer);
+}
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept {
+  Test::Detail::deallocateAligned(pointer);
+}
+void operator delete(void* pointer, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  Test::Detail::deallocateAligned(pointer);
+}
+void operator delete[](void* pointer, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  Test::Detail::deallocateAligned(pointer);
+}
+
+#endif  // TEST_H_TRACK_ALLOCATIONS
+
 #endif  // VERY_SIMPLE_TEST_H
 
 /**
@@ -302,4 +6670,54 @@ inline void check(bool a) {
  * V1.6: Increase precision for printing floating point values
  * V1.7: Put #ifdef _OPENMP around pragmas to avoid warnings when compiling
  *       without -fopenmp
+ * V1.8: Quiet mode (TEST_H_QUIET, Test::setVerbosity) that only prints failing
+ *       checks
+ * V1.9: Buffer output per thread and write it to a pluggable sink in large
+ *       chunks instead of flushing after every check
+ * V1.10: Replace the unnamed OpenMP critical section by a lock-free buffer
+ *        registry and a mutex of the framework that is only taken per chunk
+ * V1.11: Count checks in 64 bit counters per thread, Test::summary()
+ * V1.12: Collect the results of all MPI ranks on rank 0 (TEST_H_MPI)
+ * V1.13: Format values only when they are printed, numbers with std::to_chars
+ *        directly into the output buffer
+ * V1.14: Register tests in a table, Test::runAll() and TEST_H_AUTORUN
+ * V1.15: Run registered tests in parallel on a work-stealing thread pool
+ *        (Test::setThreads, TEST_H_THREADS)
+ * V1.16: Measure the wall time of tests and list the slowest tests in the
+ *        summary (Test::setTiming, TEST_H_TIMING)
+ * V1.17: BENCHMARK macro for micro benchmarks
+ * V1.18: check_range and check_span compare whole arrays as one check
+ * V1.19: Configurable tolerances for floating point checks (Test::Tolerance),
+ *        AVX2, AVX-512 and NEON kernels for check_range
+ * V1.20: Compare values of different types directly if they have a common
+ *        operator==, e.g. std::string and const char*, instead of converting
+ * V1.21: Compare strings and character arrays as std::string_view, escape
+ *        strings in the output and shorten long ones
+ * V1.22: Per-thread InstanceCounter slots with TEST_H_PER_THREAD_COUNTERS
+ * V1.23: Peak and memory of InstanceCounter, live(), peak(), total() and
+ *        bytes() queries
+ * V1.24: Allocation tracking (TEST_H_TRACK_ALLOCATIONS), check_allocations(),
+ *        Test::AllocationScope and NO_ALLOC_SCOPE
+ * V1.25: Streaming reporters for JUnit XML, TAP and JSON Lines
+ *        (Test::setReporter, TEST_H_REPORTER), Test::FileSink and TEST_H_OUTPUT
+ * V1.26: Print file, line and test name of failing checks
+ *        (Test::SourceLocation, CHECK macro)
+ * V1.27: require() aborts the test on failure, Test::setMaxFailures and
+ *        TEST_H_MAX_FAILURES limit the printed failures and skip the
+ *        remaining tests
+ * V1.28: Test filters and shards (Test::runAll(argc, argv), TEST_H_FILTER,
+ *        TEST_H_SHARD), balanced by recorded timings
+ * V1.29: Test::setProcesses runs the tests in forked worker processes that
+ *        report through shared memory, crashing tests only fail themselves
+ * V1.30: Tests are registered in a constant-initialized intrusive list
+ * V1.31: PROPERTY with seeded generators, parallel cases and shrinking
+ * V1.32: check_golden() compares with memory-mapped binary golden files
+ * V1.33: Split mode (TEST_H_SPLIT, TEST_H_IMPLEMENTATION) compiles the
+ *        framework in one source file only
+ * V1.34: Asynchronous mode (Test::setAsync, TEST_H_ASYNC) formats and writes
+ *        the output on a background thread fed by a lock-free queue
+ * V1.35: STRESS_TEST runs a test body on many pinned threads behind a barrier
+ * V1.36: Benchmark baselines per machine (--baseline, --update-baseline),
+ *        regressions fail a Mann-Whitney U check
+ * V1.37: Hardware counters of tests (Test::PerfCounters, TEST_H_PERF_COUNTERS)
  */
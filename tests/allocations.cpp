@@ -0,0 +1,98 @@
+// Self-test of the allocation tracking. Test::allocations() must count every
+// form of operator new and delete on the calling thread only, and
+// check_allocations(), Test::AllocationScope and NO_ALLOC_SCOPE must fail
+// exactly when their limit is exceeded.
+#define TEST_H_AUTORUN 0
+#define TEST_H_TRACK_ALLOCATIONS
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct alignas(64) Aligned {
+  char data[64];
+};
+
+/**
+ * Whether function adds a failing check
+ */
+template <typename Function>
+bool fails(const Function& function) {
+  const std::uint64_t failed = Test::summary().failed;
+  function();
+  return Test::summary().failed != failed;
+}
+
+}  // namespace
+
+TEST(Counts) {
+  const Test::Allocations start = Test::allocations();
+  delete new int(1);
+  delete[] new int[4];
+  delete new (std::nothrow) int(2);
+  delete new Aligned;
+  const Test::Allocations end = Test::allocations();
+  check(end.allocations - start.allocations, std::uint64_t{4});
+  check(end.deallocations - start.deallocations, std::uint64_t{4});
+  check(end.bytes - start.bytes >= 6 * sizeof(int) + sizeof(Aligned));
+}
+
+TEST(OtherThreads) {
+  const Test::Allocations start = Test::allocations();
+  // the thread is created before the measured part
+  std::thread thread;
+  const Test::Allocations before = Test::allocations();
+  thread = std::thread([] {
+    for (int i = 0; i < 100; ++i)
+      delete new int(i);
+  });
+  thread.join();
+  const Test::Allocations after = Test::allocations();
+  check(before.allocations, start.allocations);
+  // creating the thread may allocate its state on this thread, but not more
+  check(after.allocations - before.allocations <= 2);
+}
+
+TEST(Limits) {
+  std::vector<int> values;
+  check(!fails([&] { check_allocations(1, [&] { values.push_back(1); }); }));
+  check(fails([&] {
+    check_allocations(0, [] { std::make_unique<int>(3); });
+  }));
+  check(!fails([] {
+    NO_ALLOC_SCOPE;
+    int sum = 0;
+    for (int i = 0; i < 10; ++i)
+      Test::doNotOptimize(sum += i);
+  }));
+  check(fails([] {
+    NO_ALLOC_SCOPE;
+    std::make_unique<int>(4);
+  }));
+  check(!fails([] {
+    Test::AllocationScope scope(3);
+    std::make_unique<int>(5);
+    std::make_unique<int>(6);
+  }));
+  check(fails([] {
+    Test::AllocationScope scope(3);
+    for (int i = 0; i < 4; ++i)
+      std::make_unique<int>(i);
+  }));
+}
+
+int main() {
+  Test::runAll();
+  // each of the limits fails 3 times on purpose
+  const Test::Summary summary = Test::summary();
+  const bool passed = summary.failed == 3;
+  std::cout << (passed ? "The allocations were counted as expected\n"
+                       : "Unexpected allocations\n");
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,86 @@
+// Self-test of the asynchronous mode. The same checks are run with and
+// without Test::setAsync(true), which TEST_H_ASYNC sets as well. The output
+// of both runs must hold the same lines: only their order across threads
+// may differ.
+#include "test.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int threads = 4;
+constexpr int checksPerThread = 2000;
+
+class CollectingSink : public Test::Sink {
+ public:
+  void write(const char* data, std::size_t size) override {
+    text.append(data, size);
+  }
+
+  std::string text;
+};
+
+/**
+ * Checks of numbers, which the writer thread formats, mixed with checks
+ * that are formatted on the checking thread, some of them failing
+ */
+void runChecks() {
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; ++t) {
+    pool.emplace_back([t] {
+      for (int i = 0; i < checksPerThread; ++i) {
+        const int value = t * checksPerThread + i;
+        check(value, i % 500 == 7 ? value + 1 : value);
+        if (i % 10 == 0) {
+          check(value * 0.5, value / 2.0);
+          const std::string text = std::to_string(value);
+          check(text, i % 700 == 3 ? "x" : text);
+          check(value % 3 != 0);
+        }
+      }
+    });
+  }
+  for (std::thread& thread : pool)
+    thread.join();
+}
+
+std::vector<std::string> sortedLines(const std::string& text) {
+  std::vector<std::string> lines;
+  std::size_t begin = 0;
+  while (begin < text.size()) {
+    std::size_t end = text.find('\n', begin);
+    if (end == std::string::npos)
+      end = text.size();
+    lines.emplace_back(text, begin, end - begin);
+    begin = end + 1;
+  }
+  std::sort(lines.begin(), lines.end());
+  return lines;
+}
+
+}  // namespace
+
+int main() {
+  CollectingSink synchronous;
+  Test::setSink(&synchronous);
+  runChecks();
+
+  CollectingSink asynchronous;
+  Test::setSink(&asynchronous);
+  Test::setAsync(true);
+  runChecks();
+  Test::setAsync(false);
+  Test::setSink(nullptr);
+
+  const std::vector<std::string> expected = sortedLines(synchronous.text);
+  const bool same = !expected.empty() &&
+                    sortedLines(asynchronous.text) == expected;
+  std::cout << (same ? "Both modes printed the same "
+                     : "The modes printed different output, ")
+            << expected.size() << " lines\n";
+  return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,99 @@
+// Self-test of the benchmark baselines. The test for a slowdown must give
+// known results, a benchmark must pass against the baseline it recorded and
+// fail once it does many times the work. Without a baseline for the machine
+// there is only a note.
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char* const file = "baselines-selftest.jsonl";
+
+// the number of additions per iteration of the benchmark
+int work = 100;
+
+class CollectingSink : public Test::Sink {
+ public:
+  void write(const char* data, std::size_t size) override {
+    text.append(data, size);
+  }
+
+  std::string text;
+};
+
+/**
+ * Output of the benchmark, sets failed if one of its checks failed
+ */
+std::string run(bool& failed) {
+  CollectingSink sink;
+  const std::uint64_t failedBefore = Test::summary().failed;
+  Test::setSink(&sink);
+  Test::runAll();
+  Test::setSink(nullptr);
+  failed = Test::summary().failed != failedBefore;
+  return sink.text;
+}
+
+}  // namespace
+
+TEST(SlowdownTest) {
+  const std::vector<double> fast = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  const std::vector<double> slow = {11, 12, 13, 14, 15, 16, 17, 18, 19, 20};
+  check(Test::Detail::mannWhitneyGreater(fast, slow) < 1e-3);
+  check(Test::Detail::mannWhitneyGreater(slow, fast) > 0.999);
+  const double same = Test::Detail::mannWhitneyGreater(fast, fast);
+  check(same > 0.4 && same < 0.6);
+}
+
+BENCHMARK(Additions) {
+  benchmark.setMinTime(0.05);
+  benchmark.run([] {
+    int sum = 0;
+    for (int i = 0; i < work; ++i)
+      Test::doNotOptimize(sum += i);
+  });
+}
+
+int main() {
+  std::remove(file);
+  Test::setBaselineFile(file);
+  Test::setMachine("selftest");
+  bool passed = true;
+  bool failed = false;
+
+  Test::setUpdateBaseline(true);
+  std::string output = run(failed);
+  passed = passed && !failed;
+  Test::setUpdateBaseline(false);
+
+  // the same work, with a generous threshold against noise
+  Test::setRegressionThreshold(1);
+  output += run(failed);
+  passed = passed && !failed;
+
+  work *= 50;
+  Test::setRegressionThreshold(0.1);
+  const std::string slower = run(failed);
+  output += slower;
+  passed = passed && failed &&
+           slower.find("benchmark Additions is ") != std::string::npos &&
+           slower.find("slower than its baseline on machine selftest") !=
+               std::string::npos;
+
+  Test::setMachine("elsewhere");
+  output += run(failed);
+  passed = passed && !failed &&
+           output.find("no baseline for machine elsewhere") !=
+               std::string::npos;
+
+  std::remove(file);
+  std::cout << (passed ? "The baselines were compared as expected\n"
+                       : "Unexpected comparisons:\n" + output);
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,92 @@
+// Self-test of the hardware counters. Where they are available, a loop must
+// count at least one instruction per iteration, the counts must grow, and
+// with Test::setPerfCounters(true) every test must pass its counts to the
+// reporter. Elsewhere all counts must be 0 and the reporter gets none.
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int loops = 1000000;
+
+void loop() {
+  volatile int sum = 0;
+  for (int i = 0; i < loops; ++i)
+    sum = sum + i;
+}
+
+void checkCounts(const Test::PerfCounts& counts, bool available) {
+  check(counts.available, available);
+  if (available) {
+    check(counts.cycles > 0);
+    check(counts.instructions >= static_cast<std::uint64_t>(loops));
+  } else {
+    check(counts.cycles + counts.instructions + counts.cacheMisses +
+              counts.branchMisses,
+          std::uint64_t{0});
+  }
+}
+
+/**
+ * Keeps the counts of the finished tests, it has to live until the end of
+ * the program
+ */
+class CountingReporter : public Test::Reporter {
+ public:
+  void checked(std::string&, const Test::CheckEvent&) override {}
+
+  void testFinished(std::string&, const Test::TestEvent& test) override {
+    names.push_back(test.test->name);
+    counted.push_back(test.counters != nullptr);
+    counts.push_back(test.counters != nullptr ? *test.counters
+                                              : Test::PerfCounts());
+  }
+
+  std::vector<std::string> names;
+  std::vector<bool> counted;
+  std::vector<Test::PerfCounts> counts;
+} reporter;
+
+bool available() {
+  const Test::PerfCounters counters;
+  return counters.available();
+}
+
+}  // namespace
+
+TEST(Loop) { loop(); }
+
+TEST(Direct) {
+  const Test::PerfCounters counters;
+  loop();
+  const Test::PerfCounts first = counters.read();
+  loop();
+  const Test::PerfCounts second = counters.read();
+  checkCounts(first, counters.available());
+  checkCounts(second, counters.available());
+  if (counters.available())
+    check(second.instructions > first.instructions);
+}
+
+int main() {
+  Test::setReporter(&reporter);
+  Test::setPerfCounters(true);
+  Test::runAll();
+
+  const char* const names[] = {"Loop", "Direct"};
+  check(reporter.names.size(), std::size(names));
+  for (std::size_t i = 0; i < reporter.names.size() && i < 2; ++i) {
+    check(reporter.names[i], names[i]);
+    check(static_cast<bool>(reporter.counted[i]), available());
+  }
+  if (!reporter.counts.empty() && available())
+    checkCounts(reporter.counts.front(), true);
+  std::cout << "Hardware counters are "
+            << (available() ? "available\n" : "not available\n");
+  return Test::summary().failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,70 @@
+// Self-test of require() and Test::setMaxFailures(). A failing require()
+// must end its test, only the first failures may be printed, later ones are
+// still counted and the tests after the limit are skipped.
+#define TEST_H_AUTORUN 0
+#include "test.h"
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr std::uint64_t maxFailures = 3;
+
+bool afterRequire = false;
+bool afterLimit = false;
+
+class CollectingSink : public Test::Sink {
+ public:
+  void write(const char* data, std::size_t size) override {
+    text.append(data, size);
+  }
+
+  std::string text;
+};
+
+std::size_t count(std::string_view text, std::string_view part) {
+  std::size_t result = 0;
+  for (std::size_t i = text.find(part); i != std::string_view::npos;
+       i = text.find(part, i + part.size()))
+    ++result;
+  return result;
+}
+
+}  // namespace
+
+TEST(RequireFails) {
+  require(1 + 1, 3);
+  afterRequire = true;
+}
+
+// the limit is reached within this test, two failures are not printed
+TEST(FailsOften) {
+  for (int i = 0; i < 4; ++i)
+    check(i, -1);
+  check(2 * 2, 4);
+}
+
+TEST(AfterTheLimit) {
+  afterLimit = true;
+  check(true);
+}
+
+int main() {
+  CollectingSink sink;
+  Test::setSink(&sink);
+  Test::setMaxFailures(maxFailures);
+  Test::runAll();
+  Test::setSink(nullptr);
+
+  const Test::Summary summary = Test::summary();
+  const bool passed =
+      !afterRequire && !afterLimit && summary.executed == 6 &&
+      summary.failed == 5 && count(sink.text, "Error in test") == maxFailures &&
+      count(sink.text, "Reached the maximum of 3 failures") == 1 &&
+      count(sink.text, "Skipping the remaining tests") == 1;
+  std::cout << (passed ? "The failures are the expected ones\n"
+                       : "Unexpected failures or tests:\n" + sink.text);
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
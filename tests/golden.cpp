@@ -0,0 +1,106 @@
+// Self-test of check_golden(). Values written with the update mode must
+// compare equal afterwards, within the tolerance. A changed element, another
+// size or type, a missing file and a file that does not hold whole elements
+// must fail.
+#define TEST_H_AUTORUN 0
+#include "test.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char* const directory = "golden-selftest";
+
+class CollectingSink : public Test::Sink {
+ public:
+  void write(const char* data, std::size_t size) override {
+    text.append(data, size);
+  }
+
+  std::string text;
+};
+
+std::vector<double> sine() {
+  std::vector<double> values(100);
+  for (std::size_t i = 0; i < values.size(); ++i)
+    values[i] = std::sin(0.1 * static_cast<double>(i));
+  return values;
+}
+
+/**
+ * Whether function adds a failing check, its output is kept in sink
+ */
+template <typename Function>
+bool fails(CollectingSink& sink, const Function& function) {
+  const std::uint64_t failed = Test::summary().failed;
+  sink.text.clear();
+  Test::setSink(&sink);
+  function();
+  Test::setSink(nullptr);
+  return Test::summary().failed != failed;
+}
+
+}  // namespace
+
+int main() {
+  // only created by the framework on POSIX systems
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directory(directory);
+  Test::setGoldenDirectory(directory);
+  CollectingSink sink;
+  int unexpected = 0;
+  const auto expect = [&](bool failure, const char* output,
+                          const auto& function) {
+    if (fails(sink, function) != failure ||
+        sink.text.find(output) == std::string::npos) {
+      std::cout << "Unexpected result, expected \"" << output
+                << "\" in:\n" << sink.text;
+      ++unexpected;
+    }
+  };
+
+  Test::setUpdateGolden(true);
+  expect(false, "written with 100 elements",
+         [] { check_golden("sine", sine()); });
+  expect(false, "is up to date", [] { check_golden("sine", sine()); });
+  Test::setUpdateGolden(false);
+
+  expect(false, "", [] { check_golden("sine", sine()); });
+  expect(false, "", [] {
+    std::vector<double> values = sine();
+    values[50] += 1e-6;
+    check_golden("sine", values);
+  });
+  expect(true, "Error", [] {
+    std::vector<double> values = sine();
+    values[50] += 1;
+    check_golden("sine", values);
+  });
+  expect(true, "Error", [] {
+    std::vector<double> values = sine();
+    values.pop_back();
+    check_golden("sine", values);
+  });
+  expect(true, "holds elements of a different type", [] {
+    const std::vector<float> values(100);
+    check_golden("sine", values);
+  });
+  expect(true, "not found", [] { check_golden("absent", sine()); });
+
+  std::filesystem::copy_file(std::string(directory) + "/sine.golden",
+                             std::string(directory) + "/padded.golden");
+  std::ofstream(std::string(directory) + "/padded.golden",
+                std::ios::binary | std::ios::app)
+      << "abc";
+  expect(true, "has the wrong size", [] { check_golden("padded", sine()); });
+
+  std::filesystem::remove_all(directory);
+  if (unexpected == 0)
+    std::cout << "The golden files compare as expected\n";
+  return unexpected == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
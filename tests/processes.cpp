@@ -0,0 +1,46 @@
+// Self-test of the worker processes of Test::setProcesses(). Tests that
+// crash, exit or throw must fail on their own, and the checks of all other
+// tests must arrive in the main process, also when their output is larger
+// than the shared ring buffer.
+#define TEST_H_AUTORUN 0
+#include "test.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+// the output of the passing checks is several times the ring buffer
+constexpr int manyChecks = 5000;
+
+}  // namespace
+
+TEST(Passes) { check(1 + 1, 2); }
+
+TEST(Aborts) { std::abort(); }
+
+TEST(ManyChecks) {
+  for (int i = 0; i < manyChecks; ++i)
+    check(i, i);
+}
+
+TEST(Segfaults) { std::raise(SIGSEGV); }
+
+TEST(Exits) { std::exit(3); }
+
+TEST(Throws) { throw std::runtime_error("thrown on purpose"); }
+
+TEST(AfterTheCrashes) { check(2 * 2, 4); }
+
+int main() {
+  Test::setProcesses(2);
+  Test::runAll();
+  // the failures above are expected, each failing test counts one check
+  const Test::Summary summary = Test::summary();
+  const bool passed =
+      summary.executed == manyChecks + 6 && summary.failed == 4;
+  std::cout << (passed ? "The failures are the expected ones\n"
+                       : "Unexpected number of checks or failures\n");
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,66 @@
+// Self-test of PROPERTY. Failing properties must be shrunk to their known
+// minimal counterexamples, a passing property must pass, and the result for
+// a seed must not depend on the number of threads trying the cases.
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+class CollectingSink : public Test::Sink {
+ public:
+  void write(const char* data, std::size_t size) override {
+    text.append(data, size);
+  }
+
+  std::string text;
+};
+
+const char* const counterexamples[] = {
+    "SmallerThan1000: property falsified by (int x) = (\"1000\")",
+    "NoLetterB: property falsified by (std::string s) = (\"b\")",
+    "NotBothLarge: property falsified by (int a, int b) = (\"10\", \"10\")",
+};
+
+/**
+ * Output of all properties when their cases are tried on the given number
+ * of threads
+ */
+std::string run(unsigned threads) {
+  CollectingSink sink;
+  Test::setSink(&sink);
+  Test::setPropertyThreads(threads);
+  Test::runAll();
+  Test::setSink(nullptr);
+  return sink.text;
+}
+
+}  // namespace
+
+PROPERTY(SmallerThan1000, int x) { check(x < 1000); }
+
+PROPERTY(NoLetterB, std::string s) { check(s.find('b') == std::string::npos); }
+
+PROPERTY(NotBothLarge, int a, int b) { check(a < 10 || b < 10); }
+
+PROPERTY(SubtractItself, int x) { check(x - x, 0); }
+
+int main() {
+  Test::setSeed(1);
+  const std::string single = run(1);
+  const std::string parallel = run(4);
+  const Test::Summary summary = Test::summary();
+
+  bool passed = single == parallel && summary.executed == 8 &&
+                summary.failed == 6 &&
+                single.find("SubtractItself") == std::string::npos;
+  for (const char* counterexample : counterexamples)
+    passed = passed && single.find(counterexample) != std::string::npos;
+  std::cout << (passed ? "The counterexamples are the expected ones\n"
+                       : "Unexpected counterexamples:\n" + single +
+                             "with more threads:\n" + parallel);
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,69 @@
+// Self-test of the registration of tests. The tests of two source files must
+// all run once, each file's in the order of its source, independent of the
+// order of static initialization. Nodes registered concurrently by several
+// threads must all end up in the list.
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "registration.h"
+
+namespace {
+
+constexpr int threads = 8;
+constexpr int nodesPerThread = 100;
+
+// plain arrays, so they are zero before any static initialization
+std::array<const char*, staticTests> order;
+int staticRuns;
+std::atomic<int> dynamicRuns;
+
+std::array<Test::Detail::TestNode, threads * nodesPerThread> nodes;
+
+void dynamicTest() { dynamicRuns.fetch_add(1, std::memory_order_relaxed); }
+
+std::ptrdiff_t position(std::string_view name) {
+  return std::find(order.begin(), order.end(), name) - order.begin();
+}
+
+}  // namespace
+
+void ran(const char* name) {
+  if (staticRuns < staticTests)
+    order[staticRuns] = name;
+  ++staticRuns;
+}
+
+TEST(First) { ran("First"); }
+
+TEST(Second) { ran("Second"); }
+
+int main() {
+  std::vector<std::thread> registering;
+  for (int t = 0; t < threads; ++t)
+    registering.emplace_back([t] {
+      for (int i = 0; i < nodesPerThread; ++i) {
+        Test::Detail::TestNode& node = nodes[t * nodesPerThread + i];
+        node.testCase = {&dynamicTest, "Dynamic", __FILE__, __LINE__, false};
+        Test::Detail::Registrar(node, false);
+      }
+    });
+  for (std::thread& thread : registering)
+    thread.join();
+
+  Test::runAll();
+  check(staticRuns, staticTests);
+  check(dynamicRuns.load(), threads * nodesPerThread);
+  check(position("First") < position("Second"));
+  check(position("OtherFirst") < position("OtherSecond"));
+  check(position("OtherSecond") < staticTests);
+  return Test::summary().failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,13 @@
+// Shared by the source files of the registration self-test
+#ifndef TEST_H_REGISTRATION_H
+#define TEST_H_REGISTRATION_H
+
+// the tests of both source files
+constexpr int staticTests = 4;
+
+/**
+ * Record that a test of either source file ran
+ */
+void ran(const char* name);
+
+#endif  // TEST_H_REGISTRATION_H
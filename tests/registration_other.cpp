@@ -0,0 +1,10 @@
+// Second source file of the registration self-test
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include "registration.h"
+
+TEST(OtherFirst) { ran("OtherFirst"); }
+
+TEST(OtherSecond) { ran("OtherSecond"); }
@@ -0,0 +1,103 @@
+// Self-test of the JUnit, TAP and JSON Lines reporters. They are given the
+// events of a known run, a test with a failing and a passing check followed
+// by a failure outside of a test, and must format them exactly as expected,
+// with the characters of the failure escaped for each format.
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <string>
+
+namespace {
+
+const Test::TestCase testCase = {nullptr, "Parse<int>", "parse.cpp", 12,
+                                 false};
+
+/**
+ * All events of the run, formatted by reporter
+ */
+std::string run(Test::Reporter& reporter) {
+  std::string out;
+  reporter.begin(out);
+  reporter.testStarted(out, testCase);
+  reporter.checked(out, Test::CheckEvent{false, &testCase, "\"a\" & <b>", "c",
+                                         {}, {"parse.cpp", 14}});
+  reporter.checked(out, Test::CheckEvent{true, &testCase, "1", "1", {},
+                                         {"parse.cpp", 15}});
+  reporter.testFinished(out, Test::TestEvent{&testCase, 2, 1, 0.25});
+  reporter.checked(out, Test::CheckEvent{false, nullptr, {}, {}, "3 mismatches",
+                                         {"main.cpp", 30}});
+  reporter.end(out, Test::Summary{3, 2});
+  return out;
+}
+
+}  // namespace
+
+TEST(JUnit) {
+  Test::JUnitReporter reporter;
+  check(run(reporter),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<testsuites>\n"
+        "<testsuite name=\"test.h\">\n"
+        "  <testcase name=\"Parse&lt;int&gt;\" classname=\"parse.cpp\" "
+        "file=\"parse.cpp\" line=\"12\" assertions=\"2\" time=\"0.25\">\n"
+        "    <failure type=\"check\" message=\"parse.cpp:14: expected value "
+        "&quot;&quot;a&quot; &amp; &lt;b&gt;&quot;, but actual value was "
+        "&quot;c&quot;\">parse.cpp:14: expected value &quot;&quot;a&quot; "
+        "&amp; &lt;b&gt;&quot;, but actual value was &quot;c&quot;</failure>\n"
+        "  </testcase>\n"
+        "  <testcase name=\"check outside of a test\">\n"
+        "    <failure type=\"check\" message=\"main.cpp:30: 3 mismatches\">"
+        "main.cpp:30: 3 mismatches</failure>\n"
+        "  </testcase>\n"
+        "  <!-- executed checks: 3, failed checks: 2 -->\n"
+        "</testsuite>\n"
+        "</testsuites>\n");
+}
+
+TEST(Tap) {
+  Test::TapReporter reporter;
+  check(run(reporter),
+        "TAP version 13\n"
+        "not ok - Parse<int>\n"
+        "  ---\n"
+        "  file: \"parse.cpp\"\n"
+        "  line: 12\n"
+        "  checks: 2\n"
+        "  seconds: 0.25\n"
+        "  failures:\n"
+        "    - message: \"parse.cpp:14: expected value \\\"\\\"a\\\" & "
+        "<b>\\\", but actual value was \\\"c\\\"\"\n"
+        "      expected: \"\\\"a\\\" & <b>\"\n"
+        "      actual: \"c\"\n"
+        "  ...\n"
+        "not ok - check outside of a test\n"
+        "  ---\n"
+        "  failures:\n"
+        "    - message: \"main.cpp:30: 3 mismatches\"\n"
+        "  ...\n"
+        "1..2\n"
+        "# executed checks: 3, failed checks: 2\n");
+}
+
+TEST(JsonLines) {
+  Test::JsonLinesReporter reporter;
+  check(run(reporter),
+        "{\"event\":\"test_started\",\"test\":\"Parse<int>\","
+        "\"file\":\"parse.cpp\",\"line\":12}\n"
+        "{\"event\":\"check\",\"passed\":false,\"test\":\"Parse<int>\","
+        "\"file\":\"parse.cpp\",\"line\":12,\"check_file\":\"parse.cpp\","
+        "\"check_line\":14,\"expected\":\"\\\"a\\\" & <b>\",\"actual\":\"c\"}\n"
+        "{\"event\":\"check\",\"passed\":true,\"test\":\"Parse<int>\","
+        "\"file\":\"parse.cpp\",\"line\":12,\"check_file\":\"parse.cpp\","
+        "\"check_line\":15,\"expected\":\"1\",\"actual\":\"1\"}\n"
+        "{\"event\":\"test_finished\",\"test\":\"Parse<int>\","
+        "\"file\":\"parse.cpp\",\"line\":12,\"checks\":2,\"failures\":1,"
+        "\"seconds\":0.25}\n"
+        "{\"event\":\"check\",\"passed\":false,\"test\":null,"
+        "\"check_file\":\"main.cpp\",\"check_line\":30,"
+        "\"message\":\"3 mismatches\"}\n"
+        "{\"event\":\"summary\",\"executed\":3,\"failed\":2}\n");
+}
+
+int main() { return Test::runAll(); }
@@ -0,0 +1,99 @@
+// Self-test of test filters and shards. The shards of the selected tests,
+// balanced by the hash of their names or by recorded timings, must run every
+// test exactly once: no test may run in two shards, and none may be left out.
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+constexpr int tests = 16;
+constexpr int shards = 4;
+
+std::array<int, tests> runs;
+std::array<int, tests> shardOf;
+int currentShard = 0;
+int excludedRuns = 0;
+
+void ran(int test) {
+  ++runs[test];
+  shardOf[test] = currentShard;
+}
+
+/**
+ * Run every shard once with the given options, after resetting the counts
+ */
+void runShards(const std::string& options) {
+  runs.fill(0);
+  for (currentShard = 0; currentShard < shards; ++currentShard) {
+    std::string shard = "--shard=" + std::to_string(currentShard) + "/" +
+                        std::to_string(shards);
+    std::string filter = "--filter=Sharded*";
+    std::string extra = options;
+    char name[] = "shards";
+    char* argv[] = {name, filter.data(), shard.data(), extra.data()};
+    check(Test::runAll(options.empty() ? 3 : 4, argv), 0);
+  }
+  for (int test = 0; test < tests; ++test)
+    check(runs[test], 1);
+}
+
+}  // namespace
+
+#define SHARDED(n) \
+  TEST(Sharded##n) { ran(n); }
+
+SHARDED(0)
+SHARDED(1)
+SHARDED(2)
+SHARDED(3)
+SHARDED(4)
+SHARDED(5)
+SHARDED(6)
+SHARDED(7)
+SHARDED(8)
+SHARDED(9)
+SHARDED(10)
+SHARDED(11)
+SHARDED(12)
+SHARDED(13)
+SHARDED(14)
+SHARDED(15)
+
+TEST(Excluded) { ++excludedRuns; }
+
+int main() {
+  // the filter excludes Sharded1 and Sharded10 to Sharded15
+  Test::setFilter("Sharded*:-Sharded1*");
+  Test::runAll();
+  for (int test = 0; test < tests; ++test)
+    check(runs[test], test == 0 || (test >= 2 && test <= 9) ? 1 : 0);
+
+  runShards("");
+
+  // Sharded0 takes as long as 8 other tests, so it gets a shard of its own
+  // and the other shards get 5 tests each
+  const char* timings = "shards-timings.txt";
+  std::FILE* file = std::fopen(timings, "wb");
+  check(file != nullptr);
+  if (file != nullptr) {
+    for (int test = 0; test < tests; ++test)
+      std::fprintf(file, "%d Sharded%d\n", test == 0 ? 8 : 1, test);
+    std::fclose(file);
+  }
+  runShards(std::string("--timings=") + timings);
+  std::remove(timings);
+  std::array<int, shards> sizes{};
+  for (int test = 0; test < tests; ++test)
+    ++sizes[shardOf[test]];
+  for (int shard = 0; shard < shards; ++shard)
+    check(sizes[shard], shard == shardOf[0] ? 1 : 5);
+
+  check(excludedRuns, 0);
+  return Test::summary().failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
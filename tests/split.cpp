@@ -0,0 +1,42 @@
+// Self-test of the split mode, built with TEST_H_SPLIT. This file only gets
+// the declarations, split_main.cpp holds the implementation. The checks of
+// both files must run, print their values and count their failures.
+#define TEST_H_AUTORUN 0
+#include "test.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "split.h"
+
+namespace {
+
+struct Point {
+  int x;
+  int y;
+
+  bool operator==(const Point& other) const {
+    return x == other.x && y == other.y;
+  }
+};
+
+std::ostream& operator<<(std::ostream& stream, const Point& point) {
+  return stream << '(' << point.x << ", " << point.y << ')';
+}
+
+}  // namespace
+
+TEST(Declarations) {
+  check(6 * 7, 42);
+  check(std::string("split"), "split");
+  check(0.1 + 0.2, 0.3);
+  const std::vector<int> values = {1, 2, 3};
+  check_range(values, {1, 2, 3});
+  check(Point{1, 2}, Point{1, 2});
+}
+
+TEST(DeclarationsFail) {
+  check(Point{1, 2}, Point{2, 1});
+  check(std::string("split"), "merged");
+}
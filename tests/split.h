@@ -0,0 +1,13 @@
+// Shared by the source files of the split mode self-test
+#ifndef TEST_H_SPLIT_H
+#define TEST_H_SPLIT_H
+
+// the failures of split.cpp, in the format of the text output
+constexpr const char* splitFailures[] = {
+    "Error in test DeclarationsFail: expected value \"(2, 1)\", but actual "
+    "value was \"(1, 2)\"",
+    "Error in test DeclarationsFail: expected value \"merged\", but actual "
+    "value was \"split\"",
+};
+
+#endif  // TEST_H_SPLIT_H
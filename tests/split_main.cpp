@@ -0,0 +1,39 @@
+// Implementation of the split mode self-test, see split.cpp
+#define TEST_H_AUTORUN 0
+#define TEST_H_IMPLEMENTATION
+#include "test.h"
+
+#include <cstdlib>
+#include <string>
+
+#include "split.h"
+
+namespace {
+
+class CollectingSink : public Test::Sink {
+ public:
+  void write(const char* data, std::size_t size) override {
+    text.append(data, size);
+  }
+
+  std::string text;
+};
+
+}  // namespace
+
+TEST(Implementation) { check(1 + 1, 2); }
+
+int main() {
+  CollectingSink sink;
+  Test::setSink(&sink);
+  Test::runAll();
+  Test::setSink(nullptr);
+
+  const Test::Summary summary = Test::summary();
+  bool passed = summary.executed == 8 && summary.failed == 2;
+  for (const char* failure : splitFailures)
+    passed = passed && sink.text.find(failure) != std::string::npos;
+  std::cout << (passed ? "Both files checked as expected\n"
+                       : "Unexpected checks:\n" + sink.text);
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
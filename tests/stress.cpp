@@ -0,0 +1,77 @@
+// Self-test of STRESS_TEST. Every thread must run all its iterations in
+// order, the checks of all threads must be counted for the test, and a
+// failing require() on one thread must stop the others as well.
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+constexpr std::size_t threads = 4;
+constexpr std::uint64_t iterations = 10000;
+// far more than the other threads can run before the first one fails
+constexpr std::uint64_t endless = 1000000000;
+constexpr std::uint64_t failingIteration = 100;
+
+std::atomic<std::uint64_t> counter = 0;
+std::array<std::uint64_t, threads> next{};
+std::array<std::uint64_t, threads> stopped{};
+
+class CollectingSink : public Test::Sink {
+ public:
+  void write(const char* data, std::size_t size) override {
+    text.append(data, size);
+  }
+
+  std::string text;
+};
+
+std::size_t count(const std::string& text, const std::string& part) {
+  std::size_t result = 0;
+  for (std::size_t i = text.find(part); i != std::string::npos;
+       i = text.find(part, i + part.size()))
+    ++result;
+  return result;
+}
+
+}  // namespace
+
+STRESS_TEST(Increments, threads, iterations) {
+  counter.fetch_add(1, std::memory_order_relaxed);
+  check(stress.threads, threads);
+  check(stress.iteration, next[stress.thread]++);
+}
+
+STRESS_TEST(RequireStopsAll, threads, endless) {
+  if (stress.thread == 0)
+    require(stress.iteration < failingIteration);
+  ++stopped[stress.thread];
+}
+
+int main() {
+  CollectingSink sink;
+  Test::setSink(&sink);
+  Test::runAll();
+  Test::setSink(nullptr);
+
+  bool passed = counter.load() == threads * iterations;
+  for (std::size_t thread = 0; thread < threads; ++thread)
+    passed = passed && next[thread] == iterations &&
+             (thread == 0 ? stopped[thread] == failingIteration
+                          : stopped[thread] < endless);
+  // both checks of every iteration, and the require() calls of thread 0
+  const Test::Summary summary = Test::summary();
+  const std::uint64_t checks = 2 * threads * iterations + failingIteration + 1;
+  passed = passed && summary.executed == checks && summary.failed == 1 &&
+           count(sink.text, ": 10000 iterations in ") == threads &&
+           count(sink.text, ", 20000 checks, 0 failed\n") == threads &&
+           count(sink.text, ", 101 checks, 1 failed\n") == 1;
+  std::cout << (passed ? "All threads ran and stopped as expected\n"
+                       : "Unexpected iterations or checks:\n" + sink.text);
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
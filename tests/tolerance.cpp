@@ -0,0 +1,124 @@
+// Self-test of the floating point tolerances and the SIMD kernels of
+// check_range(). Comparisons with infinities, NaN and denormals have known
+// results. For every array size and every position of a changed element the
+// kernels must count the same mismatches as the scalar comparison, which
+// covers the elements after the last full vector for every number of lanes.
+#define TEST_H_AUTORUN 0
+#define TEST_H_QUIET
+#include "test.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace {
+
+// more than four vectors of the widest kernel, 16 floats with AVX-512
+constexpr std::size_t maxSize = 67;
+
+const Test::Tolerance tolerances[] = {
+    Test::Tolerance(), Test::Tolerance::relative(1e-6),
+    Test::Tolerance::ulps(4),
+    Test::Tolerance::ulps(4) | Test::Tolerance::absolute(1e-12)};
+
+/**
+ * Values close to and far from value, for each bound of the tolerances
+ */
+template <typename T>
+std::vector<T> changes(T value) {
+  const T infinity = std::numeric_limits<T>::infinity();
+  std::vector<T> result = {value + 1, value + static_cast<T>(1e-5),
+                           value * static_cast<T>(1 + 1e-7), infinity,
+                           std::numeric_limits<T>::quiet_NaN()};
+  T next = value;
+  for (int ulps = 1; ulps <= 5; ++ulps) {
+    next = std::nextafter(next, infinity);
+    result.push_back(next);
+  }
+  return result;
+}
+
+template <typename T>
+void checkKernel() {
+  for (std::size_t size = 0; size <= maxSize; ++size) {
+    std::vector<T> expected(size);
+    for (std::size_t i = 0; i < size; ++i)
+      expected[i] = static_cast<T>((static_cast<int>(i % 7) - 3) * 0.37);
+    for (const Test::Tolerance& tolerance : tolerances) {
+      check(Test::Detail::countMismatches(expected.data(), expected.data(),
+                                          size, tolerance),
+            std::size_t{0});
+      for (std::size_t position = 0; position < size; ++position) {
+        std::vector<T> actual = expected;
+        for (const T change : changes(expected[position])) {
+          actual[position] = change;
+          // the overload for T runs the kernels, the template the scalar loop
+          check(Test::Detail::countMismatches(expected.data(), actual.data(),
+                                              size, tolerance),
+                Test::Detail::countMismatches<T>(
+                    expected.data(), actual.data(), size, tolerance));
+        }
+        actual[position] = expected[position] + 1;
+        check(Test::Detail::countMismatches(expected.data(), actual.data(),
+                                            size, tolerance),
+              std::size_t{1});
+      }
+    }
+  }
+}
+
+/**
+ * Comparisons with known results, for the scalar comparison and the kernels
+ */
+template <typename T>
+void checkKnownResults() {
+  using Limits = std::numeric_limits<T>;
+  const T infinity = Limits::infinity();
+  const T nan = Limits::quiet_NaN();
+  const T denormal = Limits::denorm_min();
+  const struct {
+    T expected;
+    T actual;
+    Test::Tolerance tolerance;
+    bool equal;
+  } cases[] = {
+      {1, infinity, Test::Tolerance::relative(1e-12), false},
+      {static_cast<T>(1e30), -infinity, Test::Tolerance::relative(1e-12),
+       false},
+      {42, infinity, Test::Tolerance::relative(1e-9) | Test::Tolerance::ulps(4),
+       false},
+      {Limits::max(), infinity, Test::Tolerance::ulps(4), false},
+      {infinity, infinity, Test::Tolerance::relative(1e-9), true},
+      {-infinity, infinity, Test::Tolerance::relative(1e-9), false},
+      {nan, nan, Test::Tolerance::relative(1e-9), false},
+      {nan, nan, Test::Tolerance::ulps(4), false},
+      {nan, 1, Test::Tolerance(), false},
+      {denormal, 3 * denormal, Test::Tolerance::ulps(2), true},
+      {denormal, 4 * denormal, Test::Tolerance::ulps(2), false},
+      {0, denormal, Test::Tolerance::ulps(1), true},
+      {Limits::min(), std::nextafter(Limits::min(), T(0)),
+       Test::Tolerance::ulps(1), true},
+      {Limits::min(), Limits::min() - 2 * denormal, Test::Tolerance::ulps(1),
+       false},
+  };
+  for (const auto& c : cases) {
+    check(Test::Detail::isClose(c.expected, c.actual, c.tolerance), c.equal);
+    const std::vector<T> expected(maxSize, c.expected);
+    const std::vector<T> actual(maxSize, c.actual);
+    check(Test::Detail::countMismatches(expected.data(), actual.data(),
+                                        maxSize, c.tolerance),
+          c.equal ? std::size_t{0} : maxSize);
+  }
+}
+
+}  // namespace
+
+TEST(FloatKnownResults) { checkKnownResults<float>(); }
+
+TEST(DoubleKnownResults) { checkKnownResults<double>(); }
+
+TEST(FloatKernel) { checkKernel<float>(); }
+
+TEST(DoubleKernel) { checkKernel<double>(); }
+
+int main() { return Test::runAll(); }